@@ -2,9 +2,35 @@
 #include <string>
 #include <vector>
 #include <limits.h>
+#include <cstdint>
+#include <chrono>
+#include <cstdlib>
+#include <atomic>
+#include <thread>
+#include <functional>
+#include <sstream>
+#include <mutex>
+#include <cstring>
+#include <cassert>
+#include <cmath>
+#include <string_view>
+#include <iterator>
+#include <deque>
+#include <condition_variable>
+#include <fstream>
+#include <algorithm>
+#include <ctime>
+#include <random>
+#ifdef USE_PEXT
+#include <immintrin.h>
+#endif
+#include "chess.h"
 
 using namespace std;
 
+// 64 bit unsigned integer used for bitboards
+typedef unsigned long long U64;
+
 // Enumerating Pieces
 // o -> Offboard Square
 // e -> Empty Square
@@ -12,40 +38,24 @@ using namespace std;
 // Uppercase -> White Piece, Lowercase -> Black Piece
 enum pieces {o, e, P, B, N, R, Q, K, p, b, n, r, q, k};    // 0, 1, 2, 3, 4.......
 
+// Enumerating Sides
+// Piece of a side = white piece + 6 * side, e.g. N + 6 * black = n
+enum sides {white, black, both};
+
 // Ascii Encoding
 string ascii_pieces = "o.PBNRQKpbnrqk";
 
 // Unicode Encoding
 string unicode_pieces[14] = {"o", ".", "♙", "♗", "♘", "♖", "♕", "♔", "♟︎", "♝", "♞", "♜", "♛", "♚"};
 
-int char_pieces[] = {
-    ['P'] = P,
-    ['N'] = N,
-    ['B'] = B,
-    ['R'] = R,
-    ['Q'] = Q,
-    ['K'] = K,
-    ['p'] = p,
-    ['n'] = n,
-    ['b'] = b,
-    ['r'] = r,
-    ['q'] = q,
-    ['k'] = k,
-};
-
-// Chess Board
-int chess_board[8][16] = {
-    {r, n, b, q, k, b, n, r,    o, o, o, o, o, o, o, o},
-    {p, p, p, p, p, p, p, p,    o, o, o, o, o, o, o, o},
-    {e, e, e, e, e, e, e, e,    o, o, o, o, o, o, o, o},
-    {e, e, e, e, e, e, e, e,    o, o, o, o, o, o, o, o},
-    {e, e, e, e, e, e, e, e,    o, o, o, o, o, o, o, o},
-    {e, e, e, e, e, e, e, e,    o, o, o, o, o, o, o, o},
-    {P, P, P, P, P, P, P, P,    o, o, o, o, o, o, o, o},
-    {R, N, B, Q, K, B, N, R,    o, o, o, o, o, o, o, o}
-};
+// Convert FEN character to piece, ascii_pieces is in the same order as the pieces enum
+int char_pieces(char piece){
+    size_t index = ascii_pieces.find(piece);
+    return (index == string::npos || index < P) ? e : (int)index;
+}
 
 // Enumerating chess squares/positions
+// 0x88 layout, used by the move encoding
 enum positions {
     a8 = 0, b8, c8, d8, e8, f8, g8, h8,
     a7 = 16, b7, c7, d7, e7, f7, g7, h7,
@@ -57,6 +67,15 @@ enum positions {
     a1 = 112, b1, c1, d1, e1, f1, g1, h1, no_sq
 };
 
+// Convert 0x88 square to bitboard square (rank index * 8 + file index, a8 = 0 ... h1 = 63) and back
+int index_64(int square){
+    return (square + (square & 7)) >> 1;
+}
+
+int index_0x88(int square){
+    return square + (square & ~7);
+}
+
 // Convert board index to chess position
 string index_to_position[8][8] = {
     {"a8", "b8", "c8", "d8", "e8", "f8", "g8", "h8"},
@@ -83,28 +102,77 @@ enum castling {Kc = 1, Qc = 2, kc = 4, qc = 8};
 // If black king side rook moves, then castling rights -> 1011 = 11
 // If black queen side rook moves, then castling rights -> 0111 = 7
 // So if source or destination square is among the king or rook starting square, then AND operation does the work
-int castling_rights[8][16] = {
-    {7, 15, 15, 15, 3, 15, 15, 11,      0, 0, 0, 0, 0, 0, 0, 0},
-    {15, 15, 15, 15, 15, 15, 15, 15,    0, 0, 0, 0, 0, 0, 0, 0},
-    {15, 15, 15, 15, 15, 15, 15, 15,    0, 0, 0, 0, 0, 0, 0, 0},
-    {15, 15, 15, 15, 15, 15, 15, 15,    0, 0, 0, 0, 0, 0, 0, 0},
-    {15, 15, 15, 15, 15, 15, 15, 15,    0, 0, 0, 0, 0, 0, 0, 0},
-    {15, 15, 15, 15, 15, 15, 15, 15,    0, 0, 0, 0, 0, 0, 0, 0},
-    {15, 15, 15, 15, 15, 15, 15, 15,    0, 0, 0, 0, 0, 0, 0, 0},
-    {13, 15, 15, 15, 12, 15, 15, 14,    0, 0, 0, 0, 0, 0, 0, 0}
+int castling_rights[64] = {
+    7, 15, 15, 15, 3, 15, 15, 11,
+    15, 15, 15, 15, 15, 15, 15, 15,
+    15, 15, 15, 15, 15, 15, 15, 15,
+    15, 15, 15, 15, 15, 15, 15, 15,
+    15, 15, 15, 15, 15, 15, 15, 15,
+    15, 15, 15, 15, 15, 15, 15, 15,
+    15, 15, 15, 15, 15, 15, 15, 15,
+    13, 15, 15, 15, 12, 15, 15, 14
+};
+
+// Enough hash keys for the positions since the last irreversible move of a game (at most 100 plies + 1) & a search path
+#define MAX_KEY_HISTORY 512
+
+// Bitboard Position
+// bitboards[piece] -> squares occupied by that piece, indexed by the pieces enum (o and e are unused)
+// occupancies[white / black / both] -> union of the piece bitboards of each side
+// board[square] -> piece standing on each square, so captures don't need to search the bitboards
+// Squares are numbered rank index * 8 + file index (a8 = 0 ... h1 = 63), same as the positional value tables
+struct Position{
+    U64 bitboards[14];
+    U64 occupancies[3];
+    int board[64];
+
+    // 0 -> white, 1 -> black
+    int side_to_move;
+
+    // Castling Rights
+    int castle;
+
+    // En-passant square (0x88, same as the move encoding)
+    int enpassant;
+
+    // Zobrist hash of the position, updated incrementally by every board change
+    U64 hash_key;
+
+    // Packed middlegame & endgame score of all pieces (white positive) and game phase from material,
+    // both updated incrementally like hash_key
+    int score;
+    int phase;
+
+    // Plies since the last capture or pawn move & number of the full move, as in FEN
+    int halfmove_clock;
+    int fullmove_number;
+
+    // Hash keys of the positions along the game & search path, the current position last
+    // make_move pushes, unmake_move pops, game drivers call trim_key_history after every played move
+    U64 key_history[MAX_KEY_HISTORY];
+    int key_count;
 };
 
-// King Squares White, Black
-int king_track[2] = {e1, e8};
+// Bit manipulation
+int count_bits(U64 bitboard){
+    return __builtin_popcountll(bitboard);
+}
 
-// 0 -> white, 1 -> black
-int side_to_move = 0;
+// Index of least significant 1 bit, bitboard must be non empty
+int lsb_index(U64 bitboard){
+    return __builtin_ctzll(bitboard);
+}
 
-// Castling Rights
-int castle = 0;
+// Return least significant 1 bit index and remove it from the bitboard
+int pop_lsb(U64 &bitboard){
+    int square = lsb_index(bitboard);
+    bitboard &= bitboard - 1;
+    return square;
+}
 
-// En-passant square
-int enpassant = no_sq;
+U64 square_bit(int square){
+    return 1ULL << square;
+}
 
 // Piece Moves
 int knight_moves[8][2] = {{2,1},{2,-1},{-2,1},{-2,-1},{1,2},{-1,2},{1,-2},{-1,-2}};
@@ -116,8 +184,8 @@ int king_moves[8][2] = {{1,0},{-1,0},{0,1},{0,-1},{1,1},{1,-1},{-1,1},{-1,-1}};
 int piece_value[14] = {0, 0, 100, 350, 325, 500, 900, 100000, -100, -350, -325, -500, -900, -100000}; // usual piece value times 100
 
 // Positional Valuation {o, e, P, B, N, R, Q, K, p, b, n, r, q, k}
-// Opening positional values picked from Chess Programming Wiki
-int positional_value[14][64] = {
+// Middlegame positional values picked from Chess Programming Wiki
+int mg_positional_value[14][64] = {
     {0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0},
     {0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0},
     {
@@ -170,7 +238,16 @@ int positional_value[14][64] = {
         -10,   0,   5,   0,   0,   0,   0, -10,
         -20, -10, -10,  -5,  -5, -10, -10, -20
     },
-    {0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0},
+    {
+        -30, -40, -40, -50, -50, -40, -40, -30,
+        -30, -40, -40, -50, -50, -40, -40, -30,
+        -30, -40, -40, -50, -50, -40, -40, -30,
+        -30, -40, -40, -50, -50, -40, -40, -30,
+        -20, -30, -30, -40, -40, -30, -30, -20,
+        -10, -20, -20, -20, -20, -20, -20, -10,
+         20,  20,   0,   0,   0,   0,  20,  20,
+         20,  30,  10,   0,   0,  10,  30,  20
+    },
     {
         0,  0,  0,  0,  0,  0,  0,  0,
        -5,-10,-10, 20, 20,-10,-10, -5,
@@ -221,67 +298,607 @@ int positional_value[14][64] = {
         10,   0,   0,   0,   0,   0,   0,  10,
         20,  10,  10,   5,   5,  10,  10,  20
     },
-    {0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0}
+    {
+        -20, -30, -10,   0,   0, -10, -30, -20,
+        -20, -20,   0,   0,   0,   0, -20, -20,
+         10,  20,  20,  20,  20,  20,  20,  10,
+         20,  30,  30,  40,  40,  30,  30,  20,
+         30,  40,  40,  50,  50,  40,  40,  30,
+         30,  40,  40,  50,  50,  40,  40,  30,
+         30,  40,  40,  50,  50,  40,  40,  30,
+         30,  40,  40,  50,  50,  40,  40,  30
+    }
+};
+
+// Endgame positional values, pawns gain value as they advance & the king belongs in the centre
+int eg_positional_value[14][64] = {
+    {0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0},
+    {0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0},
+    {
+          0,   0,   0,   0,   0,   0,   0,   0,
+         80,  80,  80,  80,  80,  80,  80,  80,
+         50,  50,  50,  50,  50,  50,  50,  50,
+         30,  30,  30,  30,  30,  30,  30,  30,
+         15,  15,  15,  15,  15,  15,  15,  15,
+          5,   5,   5,   5,   5,   5,   5,   5,
+          0,   0,   0,   0,   0,   0,   0,   0,
+          0,   0,   0,   0,   0,   0,   0,   0
+    },
+    {
+        -20, -10, -10, -10, -10, -10, -10, -20,
+        -10,   0,   0,   0,   0,   0,   0, -10,
+        -10,   0,   5,   5,   5,   5,   0, -10,
+        -10,   0,   5,  10,  10,   5,   0, -10,
+        -10,   0,   5,  10,  10,   5,   0, -10,
+        -10,   0,   5,   5,   5,   5,   0, -10,
+        -10,   0,   0,   0,   0,   0,   0, -10,
+        -20, -10, -10, -10, -10, -10, -10, -20
+    },
+    {
+        -50, -40, -30, -30, -30, -30, -40, -50,
+        -40, -20, -10,  -5,  -5, -10, -20, -40,
+        -30, -10,   5,  10,  10,   5, -10, -30,
+        -30,  -5,  10,  15,  15,  10,  -5, -30,
+        -30,  -5,  10,  15,  15,  10,  -5, -30,
+        -30, -10,   5,  10,  10,   5, -10, -30,
+        -40, -20, -10,  -5,  -5, -10, -20, -40,
+        -50, -40, -30, -30, -30, -30, -40, -50
+    },
+    {
+          5,   5,   5,   5,   5,   5,   5,   5,
+         10,  10,  10,  10,  10,  10,  10,  10,
+          0,   0,   0,   0,   0,   0,   0,   0,
+          0,   0,   0,   0,   0,   0,   0,   0,
+          0,   0,   0,   0,   0,   0,   0,   0,
+          0,   0,   0,   0,   0,   0,   0,   0,
+          0,   0,   0,   0,   0,   0,   0,   0,
+          0,   0,   0,   0,   0,   0,   0,   0
+    },
+    {
+        -20, -10, -10,  -5,  -5, -10, -10, -20,
+        -10,   0,   5,   5,   5,   5,   0, -10,
+        -10,   5,  10,  10,  10,  10,   5, -10,
+         -5,   5,  10,  15,  15,  10,   5,  -5,
+         -5,   5,  10,  15,  15,  10,   5,  -5,
+        -10,   5,  10,  10,  10,  10,   5, -10,
+        -10,   0,   5,   5,   5,   5,   0, -10,
+        -20, -10, -10,  -5,  -5, -10, -10, -20
+    },
+    {
+        -50, -40, -30, -20, -20, -30, -40, -50,
+        -30, -20, -10,   0,   0, -10, -20, -30,
+        -30, -10,  20,  30,  30,  20, -10, -30,
+        -30, -10,  30,  40,  40,  30, -10, -30,
+        -30, -10,  30,  40,  40,  30, -10, -30,
+        -30, -10,  20,  30,  30,  20, -10, -30,
+        -30, -30,   0,   0,   0,   0, -30, -30,
+        -50, -30, -30, -30, -30, -30, -30, -50
+    },
+    {
+          0,   0,   0,   0,   0,   0,   0,   0,
+          0,   0,   0,   0,   0,   0,   0,   0,
+         -5,  -5,  -5,  -5,  -5,  -5,  -5,  -5,
+        -15, -15, -15, -15, -15, -15, -15, -15,
+        -30, -30, -30, -30, -30, -30, -30, -30,
+        -50, -50, -50, -50, -50, -50, -50, -50,
+        -80, -80, -80, -80, -80, -80, -80, -80,
+          0,   0,   0,   0,   0,   0,   0,   0
+    },
+    {
+         20,  10,  10,  10,  10,  10,  10,  20,
+         10,   0,   0,   0,   0,   0,   0,  10,
+         10,   0,  -5,  -5,  -5,  -5,   0,  10,
+         10,   0,  -5, -10, -10,  -5,   0,  10,
+         10,   0,  -5, -10, -10,  -5,   0,  10,
+         10,   0,  -5,  -5,  -5,  -5,   0,  10,
+         10,   0,   0,   0,   0,   0,   0,  10,
+         20,  10,  10,  10,  10,  10,  10,  20
+    },
+    {
+         50,  40,  30,  30,  30,  30,  40,  50,
+         40,  20,  10,   5,   5,  10,  20,  40,
+         30,  10,  -5, -10, -10,  -5,  10,  30,
+         30,   5, -10, -15, -15, -10,   5,  30,
+         30,   5, -10, -15, -15, -10,   5,  30,
+         30,  10,  -5, -10, -10,  -5,  10,  30,
+         40,  20,  10,   5,   5,  10,  20,  40,
+         50,  40,  30,  30,  30,  30,  40,  50
+    },
+    {
+          0,   0,   0,   0,   0,   0,   0,   0,
+          0,   0,   0,   0,   0,   0,   0,   0,
+          0,   0,   0,   0,   0,   0,   0,   0,
+          0,   0,   0,   0,   0,   0,   0,   0,
+          0,   0,   0,   0,   0,   0,   0,   0,
+          0,   0,   0,   0,   0,   0,   0,   0,
+        -10, -10, -10, -10, -10, -10, -10, -10,
+         -5,  -5,  -5,  -5,  -5,  -5,  -5,  -5
+    },
+    {
+         20,  10,  10,   5,   5,  10,  10,  20,
+         10,   0,  -5,  -5,  -5,  -5,   0,  10,
+         10,  -5, -10, -10, -10, -10,  -5,  10,
+          5,  -5, -10, -15, -15, -10,  -5,   5,
+          5,  -5, -10, -15, -15, -10,  -5,   5,
+         10,  -5, -10, -10, -10, -10,  -5,  10,
+         10,   0,  -5,  -5,  -5,  -5,   0,  10,
+         20,  10,  10,   5,   5,  10,  10,  20
+    },
+    {
+         50,  30,  30,  30,  30,  30,  30,  50,
+         30,  30,   0,   0,   0,   0,  30,  30,
+         30,  10, -20, -30, -30, -20,  10,  30,
+         30,  10, -30, -40, -40, -30,  10,  30,
+         30,  10, -30, -40, -40, -30,  10,  30,
+         30,  10, -20, -30, -30, -20,  10,  30,
+         30,  20,  10,   0,   0,  10,  20,  30,
+         50,  40,  30,  20,  20,  30,  40,  50
+    }
 };
 
+// Tapered Evaluation
+// Middlegame & endgame scores are packed into one int (endgame in the upper 16 bits), so a single add updates both
+// Kings are left out of the packed material, they are always on the board and cancel out
+int make_score(int mg, int eg){
+    return (int)((unsigned int)eg << 16) + mg;
+}
+
+int mg_score(int score){
+    return (int16_t)(unsigned int)score;
+}
+
+int eg_score(int score){
+    return (int16_t)((unsigned int)(score + 0x8000) >> 16);
+}
+
+// Game phase weights {o, e, P, B, N, R, Q, K, p, b, n, r, q, k}, 24 with all pieces on board -> 0 with only pawns & kings
+#define MAX_PHASE 24
+int phase_weight[14] = {0, 0, 0, 1, 1, 2, 4, 0, 0, 1, 1, 2, 4, 0};
+
+// Packed material + positional score of each piece on each square
+int piece_square_score[14][64];
+
+void init_evaluation_tables(){
+    for(int piece=0;piece<14;piece++){
+        int material = (piece == K || piece == k) ? 0 : piece_value[piece];
+        for(int square=0;square<64;square++){
+            piece_square_score[piece][square] = make_score(material + mg_positional_value[piece][square], material + eg_positional_value[piece][square]);
+        }
+    }
+}
+
+// Interpolate between middlegame & endgame score by game phase
+int taper_score(int score, int phase){
+    phase = min(phase, MAX_PHASE);
+    return (mg_score(score) * phase + eg_score(score) * (MAX_PHASE - phase)) / MAX_PHASE;
+}
+
 // Check if square is on board
 bool valid_move(int i, int j){
     return i >=0 && i < 8 && j >=0 && j < 8;
 }
 
-// FEN String parsing
-string starting_position = "rnbqkbnr/pppppppp/8/8/8/8/PPPPPPPP/RNBQKBNR w KQkq - 0 1";
-string random_position = "r2qk2r/pp1b1pp1/2nppn1p/3p4/3P4/2NBPN2/PPPQ1PPP/R3K2R w KQkq h2 0 9";
+// Precomputed Attack Tables
+// pawn_attacks[side][square] -> squares attacked by a pawn of side standing on square
+U64 pawn_attacks[2][64];
+U64 knight_attacks[64];
+U64 king_attacks[64];
+
+// Sliding attacks by walking each ray until a blocker (included) or the board edge
+U64 sliding_attacks(int square, U64 block, int offsets[4][2]){
+    U64 attacks = 0ULL;
+    for(int ind=0;ind<4;ind++){
+        int tarx = square/8 + offsets[ind][0], tary = square%8 + offsets[ind][1];
+        while(valid_move(tarx,tary)){
+            attacks |= square_bit(tarx*8+tary);
+
+            // Break if any piece comes in between
+            if(block & square_bit(tarx*8+tary)) break;
+
+            tarx = tarx + offsets[ind][0];
+            tary = tary + offsets[ind][1];
+        }
+    }
+    return attacks;
+}
+
+// Magic Bitboards
+// Blockers on the relevant squares of a slider (mask, board edges left out) are hashed into a table index
+// by multiplying with a magic number, or with the PEXT instruction when built with -mbmi2 -DUSE_PEXT
+// Magic numbers were found by a random search over sparse candidates, so startup only has to fill the tables
+U64 bishop_masks[64], rook_masks[64];
+U64 bishop_magics[64] = {
+    0x000208892c040040ULL, 0x80084a0096060000ULL, 0x1008880044800600ULL, 0x4104440084022041ULL,
+    0x8401104000200001ULL, 0x0100921040000008ULL, 0x0046310420043010ULL, 0x0004802101202065ULL,
+    0x3200410408008114ULL, 0x0008089084044044ULL, 0x0070410206204082ULL, 0x0028424081000440ULL,
+    0xc200040308202000ULL, 0x0402020802080804ULL, 0x0a02085208200841ULL, 0x08b8020200820804ULL,
+    0x2620224084040080ULL, 0x08c4011024280040ULL, 0x000208040404000dULL, 0x1002011420220020ULL,
+    0x0102020422010400ULL, 0x4506001900808c80ULL, 0x100c808108901004ULL, 0x18008061c6080188ULL,
+    0x0004040020489050ULL, 0x2010024008880110ULL, 0x28003000480180e0ULL, 0x080c080200220040ULL,
+    0xc01b010112104000ULL, 0xe203020001082100ULL, 0x0011204002021080ULL, 0x0800510112008240ULL,
+    0xc008020804420800ULL, 0x0040842009044848ULL, 0x0090804040040400ULL, 0x0154c00808088200ULL,
+    0x02010101040c0040ULL, 0x0804180480181040ULL, 0x2021c20200d08806ULL, 0x4001260020308402ULL,
+    0x0400901008001004ULL, 0x1021080210210208ULL, 0x4012020024002200ULL, 0x4400004200804804ULL,
+    0x8448100202900200ULL, 0x0040410401010020ULL, 0x0208084800400080ULL, 0x4014180040480109ULL,
+    0x1004010108202400ULL, 0x0208820090049003ULL, 0x1100809400880004ULL, 0x0000000020a811c0ULL,
+    0x4081082020412000ULL, 0x0800486368020002ULL, 0x0886200424008c00ULL, 0x870530008111000fULL,
+    0x100441009ba02000ULL, 0x0010102b08121002ULL, 0x4000004100809000ULL, 0x0000020428840420ULL,
+    0x9000609904450404ULL, 0x4002200428902101ULL, 0x2400600410022a41ULL, 0x8108614414004200ULL
+};
+U64 rook_magics[64] = {
+    0xa080004000201880ULL, 0x0840100040002000ULL, 0x1e800c2000100080ULL, 0x1080048010000802ULL,
+    0x0100100800040300ULL, 0x020003100c086200ULL, 0x040016b012041308ULL, 0x420002004183002cULL,
+    0x0180800080400020ULL, 0x0102401004200040ULL, 0x1012002010420080ULL, 0x2102002190c00a00ULL,
+    0x802a001009042200ULL, 0x0202000891040200ULL, 0x0010802100220080ULL, 0x0801000040810002ULL,
+    0x0040208000804000ULL, 0x0230104000200041ULL, 0x0000888020031000ULL, 0x0250008080080010ULL,
+    0x2202050011010800ULL, 0x0001010008040002ULL, 0x0003040002080110ULL, 0x1000020010408124ULL,
+    0x0010800080204008ULL, 0x8060002040005000ULL, 0x6001024300102001ULL, 0x2008008080100008ULL,
+    0x1240080080040082ULL, 0x020a020080800400ULL, 0x0000020080800100ULL, 0x1001004200010084ULL,
+    0x0e00804102002202ULL, 0x8180200040401000ULL, 0x0800802004801005ULL, 0x0080801000800800ULL,
+    0x3221004803001004ULL, 0x021c008004800200ULL, 0x042c013004004208ULL, 0x0000210042000084ULL,
+    0x00c0204002818000ULL, 0x1040200250014000ULL, 0x0100804204120020ULL, 0x8010100008008080ULL,
+    0x2082001008220005ULL, 0x001920c004080110ULL, 0x1802080102040010ULL, 0x4021002098410002ULL,
+    0x0290400080002880ULL, 0x1428804011002500ULL, 0x2000200010018480ULL, 0x8a10080080100080ULL,
+    0x2009080104008080ULL, 0x8041000400222900ULL, 0x0080100138a20400ULL, 0x0603009044110200ULL,
+    0x2010110040208001ULL, 0x0209538100264003ULL, 0x0400402080120a02ULL, 0x4006001008042042ULL,
+    0x0011000800020411ULL, 0x4082001004810802ULL, 0x0000080082011004ULL, 0x1011cc0100205082ULL
+};
+int bishop_shifts[64], rook_shifts[64];
+U64 bishop_table[64][512];
+U64 rook_table[64][4096];
+
+// false -> use ray walking slider attacks, only for comparing speed in the perft benchmark
+bool use_magic_attacks = true;
+
+int magic_index(U64 block, U64 mask, U64 magic, int shift){
+#ifdef USE_PEXT
+    return (int)_pext_u64(block, mask);
+#else
+    return (int)(((block & mask) * magic) >> shift);
+#endif
+}
+
+U64 bishop_attacks(int square, U64 block){
+    if(!use_magic_attacks) return sliding_attacks(square, block, bishop_offsets);
+    return bishop_table[square][magic_index(block, bishop_masks[square], bishop_magics[square], bishop_shifts[square])];
+}
+
+U64 rook_attacks(int square, U64 block){
+    if(!use_magic_attacks) return sliding_attacks(square, block, rook_offsets);
+    return rook_table[square][magic_index(block, rook_masks[square], rook_magics[square], rook_shifts[square])];
+}
+
+U64 queen_attacks(int square, U64 block){
+    return bishop_attacks(square, block) | rook_attacks(square, block);
+}
+
+// Lines between squares on the same rank, file or diagonal, 0 if they aren't aligned
+// between_squares[a][b] -> squares strictly between a & b
+// line_through[a][b] -> the whole board line through a & b
+U64 between_squares[64][64];
+U64 line_through[64][64];
+
+// Relevant blocker squares of a slider, the last square of each ray never blocks anything behind it
+U64 sliding_mask(int square, int offsets[4][2]){
+    U64 mask = 0ULL;
+    for(int ind=0;ind<4;ind++){
+        int tarx = square/8 + offsets[ind][0], tary = square%8 + offsets[ind][1];
+        while(valid_move(tarx + offsets[ind][0],tary + offsets[ind][1])){
+            mask |= square_bit(tarx*8+tary);
+            tarx = tarx + offsets[ind][0];
+            tary = tary + offsets[ind][1];
+        }
+    }
+    return mask;
+}
+
+// Fill the attack table of a slider on square for every blocker subset of mask
+void init_slider_table(int square, int offsets[4][2], U64 mask, U64 magic, int &shift, U64 *table){
+    int bits = count_bits(mask);
+    shift = 64 - bits;
+
+    // Enumerate all subsets of mask (carry rippler)
+    U64 subset = 0ULL;
+    for(int index=0;index<(1 << bits);index++){
+        table[magic_index(subset, mask, magic, shift)] = sliding_attacks(square, subset, offsets);
+        subset = (subset - mask) & mask;
+    }
+}
 
-void parse_fen_string_to_board(string &fen_position){
-    int curr = 0, fen_length = fen_position.length();
+// Leaper & slider attack tables, call once before using any position
+void init_attack_tables(){
     for(int i=0;i<8;i++){
         for(int j=0;j<8;j++){
-            // Check for piece
-            if((fen_position[curr] >= 'a' && fen_position[curr] <= 'z') || (fen_position[curr] >= 'A' && fen_position[curr] <= 'Z')){
-                chess_board[i][j] = char_pieces[fen_position[curr]];
-                curr++;
-            }
-            // Check for empty spaces via numbers
-            else if(fen_position[curr] >= '0' && fen_position[curr] <= '9'){
-                j += (fen_position[curr] - '0')-1;
-                curr++;
-            }
-            // Skip any /
-            if(fen_position[curr] == '/'){
-                curr++;
-            }
-            // Change configuration when space
-            else if(fen_position[curr] == ' '){
-                curr++;
+            int square = i*8+j;
+            pawn_attacks[white][square] = pawn_attacks[black][square] = knight_attacks[square] = king_attacks[square] = 0ULL;
+
+            // Pawns
+            if(valid_move(i-1,j-1)) pawn_attacks[white][square] |= square_bit((i-1)*8+j-1);
+            if(valid_move(i-1,j+1)) pawn_attacks[white][square] |= square_bit((i-1)*8+j+1);
+            if(valid_move(i+1,j-1)) pawn_attacks[black][square] |= square_bit((i+1)*8+j-1);
+            if(valid_move(i+1,j+1)) pawn_attacks[black][square] |= square_bit((i+1)*8+j+1);
+
+            // Knights & Kings
+            for(int ind=0;ind<8;ind++){
+                if(valid_move(i+knight_moves[ind][0],j+knight_moves[ind][1])) knight_attacks[square] |= square_bit((i+knight_moves[ind][0])*8+j+knight_moves[ind][1]);
+                if(valid_move(i+king_moves[ind][0],j+king_moves[ind][1])) king_attacks[square] |= square_bit((i+king_moves[ind][0])*8+j+king_moves[ind][1]);
             }
+
+            // Bishops & Rooks
+            bishop_masks[square] = sliding_mask(square, bishop_offsets);
+            rook_masks[square] = sliding_mask(square, rook_offsets);
+            init_slider_table(square, bishop_offsets, bishop_masks[square], bishop_magics[square], bishop_shifts[square], bishop_table[square]);
+            init_slider_table(square, rook_offsets, rook_masks[square], rook_magics[square], rook_shifts[square], rook_table[square]);
+        }
+    }
+
+    // Lines
+    for(int a=0;a<64;a++){
+        for(int b=0;b<64;b++){
+            between_squares[a][b] = line_through[a][b] = 0ULL;
+            if(a == b) continue;
+            int (*offsets)[2] = (sliding_attacks(a, 0ULL, bishop_offsets) & square_bit(b)) ? bishop_offsets : (sliding_attacks(a, 0ULL, rook_offsets) & square_bit(b)) ? rook_offsets : nullptr;
+            if(!offsets) continue;
+            between_squares[a][b] = sliding_attacks(a, square_bit(b), offsets) & sliding_attacks(b, square_bit(a), offsets);
+            line_through[a][b] = (sliding_attacks(a, 0ULL, offsets) & sliding_attacks(b, 0ULL, offsets)) | square_bit(a) | square_bit(b);
+        }
+    }
+}
+
+// Zobrist Hashing
+// Position hash = XOR of a random key per (piece, square), side to move, castling rights & en-passant file
+U64 piece_keys[14][64];
+U64 side_key;
+U64 castle_keys[16];
+U64 enpassant_keys[8];
+
+// Xorshift random numbers with a fixed seed, so hash keys are the same on every run
+U64 random_state = 1804289383ULL;
+U64 random_u64(){
+    random_state ^= random_state << 13;
+    random_state ^= random_state >> 7;
+    random_state ^= random_state << 17;
+    return random_state;
+}
+
+// Call once before using any position
+void init_hash_keys(){
+    for(int piece=0;piece<14;piece++){
+        for(int square=0;square<64;square++){
+            piece_keys[piece][square] = (piece >= P) ? random_u64() : 0ULL;
+        }
+    }
+    side_key = random_u64();
+    for(int rights=0;rights<16;rights++) castle_keys[rights] = random_u64();
+    for(int file=0;file<8;file++) enpassant_keys[file] = random_u64();
+}
+
+// Hash key of the position computed from scratch
+U64 generate_hash_key(Position &pos){
+    U64 key = 0ULL;
+    for(int piece=P;piece<=k;piece++){
+        U64 bitboard = pos.bitboards[piece];
+        while(bitboard) key ^= piece_keys[piece][pop_lsb(bitboard)];
+    }
+    if(pos.side_to_move == black) key ^= side_key;
+    key ^= castle_keys[pos.castle];
+    if(pos.enpassant != no_sq) key ^= enpassant_keys[pos.enpassant % 16];
+    return key;
+}
+
+// Board Updates
+// Keep bitboards, occupancies, board array and hash key in sync
+void put_piece(Position &pos, int piece, int square){
+    int side = piece >= p;
+    pos.bitboards[piece] |= square_bit(square);
+    pos.occupancies[side] |= square_bit(square);
+    pos.occupancies[both] |= square_bit(square);
+    pos.board[square] = piece;
+    pos.hash_key ^= piece_keys[piece][square];
+    pos.score += piece_square_score[piece][square];
+    pos.phase += phase_weight[piece];
+}
+
+void remove_piece(Position &pos, int square){
+    int piece = pos.board[square];
+    int side = piece >= p;
+    pos.bitboards[piece] &= ~square_bit(square);
+    pos.occupancies[side] &= ~square_bit(square);
+    pos.occupancies[both] &= ~square_bit(square);
+    pos.board[square] = e;
+    pos.hash_key ^= piece_keys[piece][square];
+    pos.score -= piece_square_score[piece][square];
+    pos.phase -= phase_weight[piece];
+}
+
+void move_piece(Position &pos, int source, int target){
+    int piece = pos.board[source];
+    remove_piece(pos, source);
+    put_piece(pos, piece, target);
+}
+
+// Clearing Board
+void clear_board(Position &pos){
+    for(int piece=0;piece<14;piece++) pos.bitboards[piece] = 0ULL;
+    for(int side=0;side<3;side++) pos.occupancies[side] = 0ULL;
+    for(int square=0;square<64;square++) pos.board[square] = e;
+    pos.side_to_move = -1;
+    pos.castle = 0;
+    pos.enpassant = no_sq;
+    pos.hash_key = 0ULL;
+    pos.score = 0;
+    pos.phase = 0;
+    pos.halfmove_clock = 0;
+    pos.fullmove_number = 1;
+    pos.key_count = 0;
+}
+
+// FEN String parsing
+string starting_position = "rnbqkbnr/pppppppp/8/8/8/8/PPPPPPPP/RNBQKBNR w KQkq - 0 1";
+string random_position = "r2qk2r/pp1b1pp1/2nppn1p/3p4/3P4/2NBPN2/PPPQ1PPP/R3K2R w KQkq h2 0 9";
+
+bool in_check(Position &pos, int side);
+
+// Reasons a FEN is rejected, fen_error_message describes each
+enum fen_errors {fen_ok, fen_bad_board, fen_bad_side, fen_bad_castling, fen_bad_enpassant, fen_bad_counters, fen_trailing_characters, fen_bad_kings, fen_bad_pawns, fen_opponent_in_check};
+
+string fen_error_message[10] = {
+    "ok", "bad piece placement", "bad side to move", "bad castling rights", "bad en-passant square",
+    "bad halfmove clock or fullmove number", "unexpected characters after the FEN", "each side needs exactly one king",
+    "pawn on the first or last rank", "side not to move is in check"
+};
+
+bool fen_space(char c){
+    return c == ' ' || c == '\t' || c == '\r' || c == '\n';
+}
+
+// Parse FEN into pos, validating every field, pos is only usable if fen_ok is returned
+// Fields are separated by any amount of whitespace, halfmove clock & fullmove number are optional (default 0 & 1)
+// Castling rights need the king & rook on their squares, the en-passant square needs the pawn that just moved
+// Without length anything after the FEN is an error, with length it gets the size of the parsed FEN, so EPD
+// operations can follow it. Works on the view, never allocates
+fen_errors parse_fen_string_to_board(Position &pos, string_view fen, size_t *length = nullptr){
+    clear_board(pos);
+    size_t curr = 0;
+
+    // Next whitespace separated field, empty at the end
+    auto next_field = [&](){
+        while(curr < fen.size() && fen_space(fen[curr])) curr++;
+        size_t start = curr;
+        while(curr < fen.size() && !fen_space(fen[curr])) curr++;
+        return fen.substr(start, curr - start);
+    };
+
+    // Piece placement, rank 8 to rank 1 separated by /
+    string_view board = next_field();
+    size_t i = 0;
+    for(int rank=0;rank<8;rank++){
+        if(rank > 0 && (i >= board.size() || board[i++] != '/')) return fen_bad_board;
+        for(int file=0;file<8;){
+            if(i >= board.size()) return fen_bad_board;
+            char c = board[i++];
+            if(c >= '1' && c <= '8') file += c - '0';
+            else if(char_pieces(c) != e) put_piece(pos, char_pieces(c), rank*8 + file++);
+            else return fen_bad_board;
+            if(file > 8) return fen_bad_board;
+        }
+    }
+    if(i != board.size()) return fen_bad_board;
+
+    // Side to move
+    string_view side = next_field();
+    if(side != "w" && side != "b") return fen_bad_side;
+    pos.side_to_move = side == "w" ? white : black;
+
+    // Castling rights, - or KQkq in this order without repeats
+    string_view castle = next_field();
+    if(castle.empty()) return fen_bad_castling;
+    if(castle != "-"){
+        string_view order = "KQkq";
+        int rights[4] = {Kc, Qc, kc, qc};
+        size_t previous = 0;
+        for(size_t j=0;j<castle.size();j++){
+            size_t right = order.find(castle[j]);
+            if(right == string_view::npos || (j > 0 && right <= previous)) return fen_bad_castling;
+            pos.castle |= rights[right];
+            previous = right;
+        }
+    }
+    if((pos.castle & (Kc | Qc)) && pos.board[index_64(e1)] != K) return fen_bad_castling;
+    if((pos.castle & (kc | qc)) && pos.board[index_64(e8)] != k) return fen_bad_castling;
+    if(((pos.castle & Kc) && pos.board[index_64(h1)] != R) || ((pos.castle & Qc) && pos.board[index_64(a1)] != R)) return fen_bad_castling;
+    if(((pos.castle & kc) && pos.board[index_64(h8)] != r) || ((pos.castle & qc) && pos.board[index_64(a8)] != r)) return fen_bad_castling;
+
+    // En-passant square, behind a pawn of the side not to move that can have just moved two squares
+    string_view enpassant = next_field();
+    if(enpassant.empty()) return fen_bad_enpassant;
+    if(enpassant != "-"){
+        if(enpassant.size() != 2 || enpassant[0] < 'a' || enpassant[0] > 'h' || enpassant[1] != (pos.side_to_move == white ? '6' : '3')) return fen_bad_enpassant;
+        int square = (8 - (enpassant[1] - '0')) * 8 + enpassant[0] - 'a';
+        int forward = pos.side_to_move == white ? 8 : -8;
+        if(pos.board[square + forward] != (pos.side_to_move == white ? p : P) || pos.board[square] != e || pos.board[square - forward] != e) return fen_bad_enpassant;
+        pos.enpassant = index_0x88(square);
+    }
+
+    // Halfmove clock & fullmove number, optional (EPD has none, its operations start with a letter)
+    for(int counter=0;counter<2;counter++){
+        size_t start = curr;
+        string_view field = next_field();
+        if(field.empty() || field[0] < '0' || field[0] > '9'){
+            curr = start;
+            break;
         }
+        if(field.size() > 6 || field.find_first_not_of("0123456789") != string_view::npos) return fen_bad_counters;
+        int value = 0;
+        for(char c : field) value = value * 10 + c - '0';
+        if(counter == 0) pos.halfmove_clock = value;
+        else pos.fullmove_number = max(value, 1);
+    }
+
+    if(length) *length = curr;
+    else{
+        while(curr < fen.size() && fen_space(fen[curr])) curr++;
+        if(curr < fen.size()) return fen_trailing_characters;
     }
 
-    // Check side to move
-    (fen_position[curr] == 'w') ? side_to_move = 0 : side_to_move = 1;
-    curr += 2;
+    // Legal position, one king each, no pawns on the first & last rank, no capturing the king
+    if(count_bits(pos.bitboards[K]) != 1 || count_bits(pos.bitboards[k]) != 1) return fen_bad_kings;
+    if((pos.bitboards[P] | pos.bitboards[p]) & 0xFF000000000000FFULL) return fen_bad_pawns;
+    if(in_check(pos, !pos.side_to_move)) return fen_opponent_in_check;
+
+    // Hash key from scratch, incremental updates start from here
+    pos.hash_key = generate_hash_key(pos);
+    pos.key_history[0] = pos.hash_key;
+    pos.key_count = 1;
+    return fen_ok;
+}
 
-    // Check for castling rights
-    while(fen_position[curr] != ' '){
-        switch (fen_position[curr]){
-            case 'K': castle += Kc; break;
-            case 'Q': castle += Qc; break;
-            case 'k': castle += kc; break;
-            case 'q': castle += qc; break;
+// FEN Writing
+// Longest FEN, 64 squares + 7 slashes + side, castling, en-passant & both counters with separators
+#define MAX_FEN_LENGTH 100
+
+// Write the FEN of the position into buffer (at least MAX_FEN_LENGTH chars, zero terminated), returns its length
+int write_fen_string(Position &pos, char *buffer){
+    int length = 0;
+    for(int rank=0;rank<8;rank++){
+        int empty = 0;
+        for(int file=0;file<8;file++){
+            int piece = pos.board[rank*8 + file];
+            if(piece == e){
+                empty++;
+                continue;
+            }
+            if(empty) buffer[length++] = '0' + empty;
+            buffer[length++] = ascii_pieces[piece];
+            empty = 0;
         }
-        curr++;
+        if(empty) buffer[length++] = '0' + empty;
+        buffer[length++] = rank < 7 ? '/' : ' ';
     }
-    curr++;
 
-    // Check for en-passant square
-    if(fen_position[curr] != '-'){
-        int file = fen_position[curr] - 'a';
-        int rank = fen_position[curr+1] - '0';
+    buffer[length++] = pos.side_to_move == white ? 'w' : 'b';
+    buffer[length++] = ' ';
+
+    if(!pos.castle) buffer[length++] = '-';
+    if(pos.castle & Kc) buffer[length++] = 'K';
+    if(pos.castle & Qc) buffer[length++] = 'Q';
+    if(pos.castle & kc) buffer[length++] = 'k';
+    if(pos.castle & qc) buffer[length++] = 'q';
+    buffer[length++] = ' ';
 
-        enpassant = file + (8 - rank) * 16;
+    if(pos.enpassant == no_sq) buffer[length++] = '-';
+    else{
+        buffer[length++] = 'a' + pos.enpassant % 16;
+        buffer[length++] = '8' - pos.enpassant / 16;
     }
 
+    length += snprintf(buffer + length, MAX_FEN_LENGTH - length, " %d %d", pos.halfmove_clock, pos.fullmove_number);
+    return length;
+}
+
+string board_to_fen_string(Position &pos){
+    char buffer[MAX_FEN_LENGTH];
+    return string(buffer, write_fen_string(pos, buffer));
 }
 
 // Encode Moves to Integers
@@ -339,16 +956,15 @@ void print_decoded_move(int move){
 
 
 // Print Chess Board
-void print_chess_board(){
+void print_chess_board(Position &pos){
     for(int i=0;i<8;i++){
-        for(int j=0;j<16;j++){
+        for(int j=0;j<8;j++){
 
             // Printing ranks 1,2,....8
             if(j == 0) cout << 8-i << "  ";
 
-            // 0x88 is 10001000 in binary used when using 1D array of 128 ==> Since for j<8 it will return 0 in bitwise AND
-            // if(j<8) cout<<ascii_pieces[chess_board[i][j]]<<" ";
-            if(j<8) cout << unicode_pieces[chess_board[i][j]] << " ";
+            // if(j<8) cout<<ascii_pieces[pos.board[i*8+j]]<<" ";
+            cout << unicode_pieces[pos.board[i*8+j]] << " ";
 
         }
         cout<<endl;
@@ -356,28 +972,24 @@ void print_chess_board(){
     // Printing file a,b....h
     cout << "\n   a b c d e f g h \n" << endl;
 
-    cout << "Side to move: " << side_to_move << endl;
+    cout << "Side to move: " << pos.side_to_move << endl;
 
-    cout << "Castling rights: " << castle << endl;
+    cout << "Castling rights: " << pos.castle << endl;
 
-    cout << "Enpassant Square: " << index_to_position[enpassant/16][enpassant%16] << endl;
-}
+    cout << "Enpassant Square: " << (pos.enpassant == no_sq ? "no" : index_to_position[pos.enpassant/16][pos.enpassant%16]) << endl;
 
-// Clearing Board
-void clear_board(){
-    for(int i=0;i<8;i++){
-        for(int j=0;j<8;j++){
-            chess_board[i][j] = e;
-        }
-    }
-    side_to_move = -1;
-    castle = 0;
+    cout << "FEN: " << board_to_fen_string(pos) << endl;
 }
 
-// Moves History
+// Move List
+// Fixed capacity buffer with a score slot per move for ordering, lives on the stack of each search node
+// so generating moves never allocates, always pass it by reference
+#define MAX_MOVES 256
+
 class Moves{
     private:
-        vector<int> moves;
+        int moves[MAX_MOVES];
+        int scores[MAX_MOVES];
         int count;
     public:
         Moves(){
@@ -387,94 +999,141 @@ class Moves{
             return count;
         }
         void add_move(int move){
-            moves.push_back(move);
-            count++;
+            moves[count++] = move;
         }
         void undo_move(){
-            moves.pop_back();
             count--;
         }
-        vector<int> get_all_moves(){
-            return moves;
+        int get_move(int index){
+            return moves[index];
+        }
+        void set_score(int index, int score){
+            scores[index] = score;
+        }
+        int get_score(int index){
+            return scores[index];
+        }
+        // Selection step of a lazy sort, brings the best scored of the remaining moves to index
+        // Moves after a cutoff are never sorted
+        void pick_next_move(int index){
+            int best = index;
+            for(int i=index+1;i<count;i++){
+                if(scores[i] > scores[best]) best = i;
+            }
+            swap(moves[index], moves[best]);
+            swap(scores[index], scores[best]);
         }
         void print_all_moves(){
             cout<<"\n\nPrinting Moves History\n\n";
-            for(int i=0;i<moves.size();i++){
+            for(int i=0;i<count;i++){
                 int move = moves[i];
                 print_decoded_move(move);
                 cout<<"\n";
             }
             cout << endl;
         }
-}moves_history;
+};
 
-// Check if square is attacked
-bool is_square_attacked(int i, int j, int side){
-    // Pawn Attacks
-    if(!side){
-        if(valid_move(i+1,j-1) && chess_board[i+1][j-1] == P) return 1;
-        if(valid_move(i+1,j+1) && chess_board[i+1][j+1] == P) return 1;
-    }
-    else{
-        if(valid_move(i-1,j-1) && chess_board[i-1][j-1] == p) return 1;
-        if(valid_move(i-1,j+1) && chess_board[i-1][j+1] == p) return 1;
-    }
+// Check if square is attacked by side
+bool is_square_attacked(Position &pos, int square, int side){
+    // Pawn Attacks, a white pawn attacks square if a black pawn on square would attack the white pawn
+    if(pawn_attacks[!side][square] & pos.bitboards[P + 6*side]) return 1;
 
     // Knight Attacks
-    for(int ind=0;ind<8;ind++){
-        int x = knight_moves[ind][0];
-        int y = knight_moves[ind][1];
-
-        if(!side && valid_move(i+x,j+y) && chess_board[i+x][j+y] == N) return 1;
-        if(side && valid_move(i+x,j+y) && chess_board[i+x][j+y] == n) return 1;
-    }
+    if(knight_attacks[square] & pos.bitboards[N + 6*side]) return 1;
 
     // King Attacks
-    for(int ind=0;ind<8;ind++){
-        int x = king_moves[ind][0];
-        int y = king_moves[ind][1];
-
-        if(!side && valid_move(i+x,j+y) && chess_board[i+x][j+y] == K) return 1;
-        if(side && valid_move(i+x,j+y) && chess_board[i+x][j+y] == k) return 1;
-    }
+    if(king_attacks[square] & pos.bitboards[K + 6*side]) return 1;
 
     // Bishop & Queen Attacks
-    for(int ind=0;ind<4;ind++){
-        int tarx = i + bishop_offsets[ind][0], tary = j + bishop_offsets[ind][1];
-        while(valid_move(tarx,tary)){
-            // Check for bishop or queen
-            if(!side && (chess_board[tarx][tary] == B || chess_board[tarx][tary] == Q)) return 1;
-            if(side && (chess_board[tarx][tary] == b || chess_board[tarx][tary] == q)) return 1;
+    if(bishop_attacks(square, pos.occupancies[both]) & (pos.bitboards[B + 6*side] | pos.bitboards[Q + 6*side])) return 1;
 
-            // Break if any piece comes in between
-            if(chess_board[tarx][tary] != e) break;
+    // Rook & Queen Attacks
+    if(rook_attacks(square, pos.occupancies[both]) & (pos.bitboards[R + 6*side] | pos.bitboards[Q + 6*side])) return 1;
 
-            tarx = tarx + bishop_offsets[ind][0];
-            tary = tary + bishop_offsets[ind][1];
-        }
+    return 0;
+}
+
+// Check if king of side is in check
+bool in_check(Position &pos, int side){
+    return is_square_attacked(pos, lsb_index(pos.bitboards[K + 6*side]), !side);
+}
+
+// All pieces of both sides attacking square, only counting the pieces in occupied
+// Sliders are looked up through occupied, so removing a piece from it uncovers the x-ray attackers behind
+U64 attackers_to(Position &pos, int square, U64 occupied){
+    U64 diagonal = pos.bitboards[B] | pos.bitboards[b] | pos.bitboards[Q] | pos.bitboards[q];
+    U64 straight = pos.bitboards[R] | pos.bitboards[r] | pos.bitboards[Q] | pos.bitboards[q];
+
+    return ((pawn_attacks[black][square] & pos.bitboards[P]) | (pawn_attacks[white][square] & pos.bitboards[p])
+          | (knight_attacks[square] & (pos.bitboards[N] | pos.bitboards[n]))
+          | (king_attacks[square] & (pos.bitboards[K] | pos.bitboards[k]))
+          | (bishop_attacks(square, occupied) & diagonal)
+          | (rook_attacks(square, occupied) & straight)) & occupied;
+}
+
+// Static Exchange Evaluation
+// Material won by the side to move (centipawns) when both sides keep recapturing on the target square
+// with their least valuable attacker, each side free to stop once recapturing would lose material
+// The king only recaptures last, capturing it is worth more than anything gained before
+int see_order[6] = {P, N, B, R, Q, K};
+
+int see(Position &pos, int move){
+    int source = index_64(source_square(move)), target = index_64(target_square(move));
+    int side = pos.side_to_move, attacker = pos.board[source], promoted = promoted_piece(move);
+    U64 occupied = pos.occupancies[both];
+
+    // gain[d] -> material won by the side making the d-th capture if the exchange stopped there
+    int gain[32], d = 0;
+    if(enpassant_flag(move)){
+        gain[0] = piece_value[P];
+        occupied ^= square_bit(target + (side == white ? 8 : -8));
     }
+    else gain[0] = abs(piece_value[pos.board[target]]);
 
-    // Rook & Queen Attacks
-    for(int ind=0;ind<4;ind++){
-        int tarx = i + rook_offsets[ind][0], tary = j + rook_offsets[ind][1];
-        while(valid_move(tarx,tary)){
-            // Check for rook or queen
-            if(!side && (chess_board[tarx][tary] == R || chess_board[tarx][tary] == Q)) return 1;
-            if(side && (chess_board[tarx][tary] == r || chess_board[tarx][tary] == q)) return 1;
+    if(promoted){
+        gain[0] += abs(piece_value[promoted]) - piece_value[P];
+        attacker = promoted;
+    }
 
-            // Break if any piece comes in between
-            if(chess_board[tarx][tary] != e) break;
+    while(d < 31){
+        // Moving piece leaves its square, uncovering sliders behind it
+        occupied ^= square_bit(source);
+        U64 attackers = attackers_to(pos, target, occupied);
+        side = !side;
+
+        // Least valuable attacker of the side to recapture
+        source = -1;
+        for(int i=0;i<6;i++){
+            U64 bitboard = attackers & pos.bitboards[see_order[i] + 6*side];
+            if(bitboard){
+                source = lsb_index(bitboard);
+                break;
+            }
+        }
+        if(source < 0) break;
+
+        d++;
+        gain[d] = abs(piece_value[attacker]) - gain[d-1];
+        attacker = pos.board[source];
 
-            tarx = tarx + rook_offsets[ind][0];
-            tary = tary + rook_offsets[ind][1];
+        // Recapturing loses material even if the exchange stopped there, so the side stands pat
+        if(max(-gain[d-1], gain[d]) < 0){
+            d--;
+            break;
         }
     }
 
-    return 0;
+    // Each side picks between stopping & recapturing, from the last capture back
+    while(d > 0){
+        gain[d-1] = -max(-gain[d-1], gain[d]);
+        d--;
+    }
+    return gain[0];
 }
 
 // Print all Attacked Squares
-void print_attacked_squares(int side){
+void print_attacked_squares(Position &pos, int side){
     cout<<"\n\n";
     for(int i=0;i<8;i++){
         for(int j=0;j<8;j++){
@@ -482,7 +1141,7 @@ void print_attacked_squares(int side){
             // Printing ranks 1,2,....8
             if(j == 0) cout << 8-i << "  ";
 
-            if(is_square_attacked(i,j,side)) cout << "x ";
+            if(is_square_attacked(pos,i*8+j,side)) cout << "x ";
             else cout << ". ";
 
         }
@@ -492,751 +1151,2369 @@ void print_attacked_squares(int side){
     cout << "\n   a b c d e f g h \n" << endl;
 }
 
-int evaluate_position(){
-    int score = 0;
-    // cout<<"\n\n";
-    for(int i=0;i<8;i++){
-        for(int j=0;j<8;j++){
-            score += piece_value[chess_board[i][j]];
-            score += positional_value[chess_board[i][j]][i*8+j];
-            // cout << positional_value[chess_board[i][j]][i*8+j] <<"\t\t";
+// Score of the position by scanning all pieces
+int evaluate_position_full(Position &pos){
+    int score = 0, phase = 0;
+    for(int piece=P;piece<=k;piece++){
+        U64 bitboard = pos.bitboards[piece];
+        while(bitboard){
+            int square = pop_lsb(bitboard);
+            score += piece_square_score[piece][square];
+            phase += phase_weight[piece];
         }
-        // cout<<endl;
     }
-    return score;
+    return taper_score(score, phase);
 }
 
-bool set_move(int move){
-    // Being handled in find_best_move now
-    // Make Board Copy
-    // int chess_board_copy[8][16];
-    // copy(&chess_board[0][0], &chess_board[0][0] + 8*16, &chess_board_copy[0][0]);
-    // int castle_copy = castle;
-    // int enpassant_copy = enpassant;
-    // int king_track_copy[2];
-    // copy(&king_track[0], &king_track[0] + 2, &king_track_copy[0]);
+// Score & phase kept up to date by put_piece & remove_piece
+// Build with -DDEBUG_EVAL to check it against a full scan on every call
+int evaluate_position(Position &pos){
+#ifdef DEBUG_EVAL
+    assert(taper_score(pos.score, pos.phase) == evaluate_position_full(pos));
+#endif
+    return taper_score(pos.score, pos.phase);
+}
+
+// Undo Record
+// State that can't be recomputed when taking a move back
+struct Undo{
+    int captured;   // captured piece, e if none
+    int castle;
+    int enpassant;
+    U64 hash_key;
+    int halfmove_clock;
+};
 
+void unmake_move(Position &pos, int move, Undo &undo);
 
+// Play move on the board & switch side to move, saving what unmake_move needs into undo
+// No legality check, the move has to come from legal move generation (else use set_move)
+void make_move(Position &pos, int move, Undo &undo){
     // Decode Integer into moves
-    int source = source_square(move), target = target_square(move), promoted = promoted_piece(move), capture = capture_flag(move), enpassant_capture = enpassant_flag(move), castling = castling_flag(move), doublepawnmove = doublepawnmove_flag(move);
+    int source = index_64(source_square(move)), target = index_64(target_square(move)), promoted = promoted_piece(move), capture = capture_flag(move), enpassant_capture = enpassant_flag(move), castling = castling_flag(move), doublepawnmove = doublepawnmove_flag(move);
+    int side = pos.side_to_move;
+
+    undo.captured = e;
+    undo.castle = pos.castle;
+    undo.enpassant = pos.enpassant;
+    undo.hash_key = pos.hash_key;
+    undo.halfmove_clock = pos.halfmove_clock;
+
+    // Captures & pawn moves can't be undone in a game, positions before them can't repeat
+    if(capture || pos.board[source] == P + 6*side) pos.halfmove_clock = 0;
+    else pos.halfmove_clock++;
+    if(side == black) pos.fullmove_number++;
+
+    // Remove captured piece
+    if(enpassant_capture){
+        undo.captured = P + 6*(!side);
+        remove_piece(pos, side == white ? target + 8 : target - 8);
+    }
+    else if(capture){
+        undo.captured = pos.board[target];
+        remove_piece(pos, target);
+    }
 
     // Update Moved Piece on Chess Board
-    chess_board[target/16][target%16] = chess_board[source/16][source%16];
-    chess_board[source/16][source%16] = e;
+    move_piece(pos, source, target);
 
     if(promoted > 0){
-        chess_board[target/16][target%16] = promoted;
+        remove_piece(pos, target);
+        put_piece(pos, promoted, target);
     }
 
-    // Handle enpassant captures
-    if(enpassant_capture){
-        if(side_to_move == 0){
-            chess_board[target/16 + 1][target%16] = e;
-        }
-        else{
-            chess_board[target/16 - 1][target%16] = e;
-        }
-    }
     // Reset enpassant_square
-    enpassant = no_sq;
+    if(pos.enpassant != no_sq) pos.hash_key ^= enpassant_keys[pos.enpassant % 16];
+    pos.enpassant = no_sq;
 
     // Add enpassant square in case of double move
     if(doublepawnmove){
-        if(side_to_move == 0){
-            enpassant = target + 16;
-        }
-        else{
-            enpassant = target - 16;
-        }
+        pos.enpassant = index_0x88(side == white ? target + 8 : target - 8);
+        pos.hash_key ^= enpassant_keys[pos.enpassant % 16];
     }
 
     // Castling Move
     if(castling){
-        if(side_to_move == 0){
-            if(target == 7*16+6){   // g1
-                chess_board[7][5] = R;
-                chess_board[7][7] = e;
-            }
-            else if(target == 7*16+2){  // c1
-                chess_board[7][3] = R;
-                chess_board[7][0] = e;
-            }
-        }
-        else{
-            if(target == 0*16+6){   // g8
-                chess_board[0][5] = r;
-                chess_board[0][7] = e;
-            }
-            else if(target == 0*16+2){  // c8
-                chess_board[0][3] = r;
-                chess_board[0][0] = e;
-            }
+        switch(index_0x88(target)){
+            case g1: move_piece(pos, index_64(h1), index_64(f1)); break;
+            case c1: move_piece(pos, index_64(a1), index_64(d1)); break;
+            case g8: move_piece(pos, index_64(h8), index_64(f8)); break;
+            case c8: move_piece(pos, index_64(a8), index_64(d8)); break;
         }
     }
 
     // Update Castling Rights
-    castle = castle & castling_rights[source/16][source%16] & castling_rights[target/16][target%16];
+    pos.hash_key ^= castle_keys[pos.castle];
+    pos.castle = pos.castle & castling_rights[source] & castling_rights[target];
+    pos.hash_key ^= castle_keys[pos.castle];
+
+    // Update Side to Move
+    pos.side_to_move = !side;
+    pos.hash_key ^= side_key;
+
+    pos.key_history[pos.key_count++] = pos.hash_key;
+}
 
-    // Update king square
-    if(chess_board[target/16][target%16] == K || chess_board[target/16][target%16] == k) king_track[side_to_move] = target;
+// Play a pseudo legal move, take it back & return false if it leaves the own king in check
+bool set_move(Position &pos, int move, Undo &undo){
+    make_move(pos, move, undo);
 
     // Check Legal Move
     // Check if after move for a side, the same side king is not in check then
-    if(is_square_attacked(king_track[side_to_move]/16,king_track[side_to_move]%16,!side_to_move)){
-        // Reset values
-        // Being handled in find_best_move now
-        // copy(&chess_board_copy[0][0], &chess_board_copy[0][0] + 8*16, &chess_board[0][0]);
-        // castle = castle_copy;
-        // enpassant = enpassant_copy;
-        // copy(&king_track_copy[0], &king_track_copy[0] + 2, &king_track[0]);
+    if(in_check(pos, !pos.side_to_move)){
+        unmake_move(pos, move, undo);
         return false;
     }
 
-    // Update Side to Move
-    // Being handled in find_best_move now
-    // side_to_move = !side_to_move;
     return true;
 }
 
-// Generate Moves
-void generate_moves(int side, Moves &possible_moves){
-    for(int i=0;i<8;i++){
-        for(int j=0;j<8;j++){
+// Take back a move played by set_move
+void unmake_move(Position &pos, int move, Undo &undo){
+    int source = index_64(source_square(move)), target = index_64(target_square(move)), promoted = promoted_piece(move), enpassant_capture = enpassant_flag(move), castling = castling_flag(move);
+    int side = !pos.side_to_move;
 
-            // White Pawn Moves
-            if(!side && chess_board[i][j] == P){
-                // Single Move
-                if(valid_move(i-1,j) && chess_board[i-1][j] == e){
-                    // Promotion
-                    if(i == 1){
-                        possible_moves.add_move(encode_move_to_integer(i*16+j,(i-1)*16+j,Q,0,0,0,0));
-                        possible_moves.add_move(encode_move_to_integer(i*16+j,(i-1)*16+j,R,0,0,0,0));
-                        possible_moves.add_move(encode_move_to_integer(i*16+j,(i-1)*16+j,B,0,0,0,0));
-                        possible_moves.add_move(encode_move_to_integer(i*16+j,(i-1)*16+j,N,0,0,0,0));
-                    }
-                    // Normal Move
-                    else{
-                        possible_moves.add_move(encode_move_to_integer(i*16+j,(i-1)*16+j,0,0,0,0,0));
-                    }
-                }
+    pos.side_to_move = side;
+    pos.castle = undo.castle;
+    pos.enpassant = undo.enpassant;
+    pos.halfmove_clock = undo.halfmove_clock;
+    if(side == black) pos.fullmove_number--;
+    pos.key_count--;
 
-                // Double Move
-                if(i == 6 && chess_board[i-1][j] == e && chess_board[i-2][j] == e){
-                    possible_moves.add_move(encode_move_to_integer(i*16+j,(i-2)*16+j,0,0,0,0,1));
-                }
+    // Demote back to pawn
+    if(promoted > 0){
+        remove_piece(pos, target);
+        put_piece(pos, P + 6*side, target);
+    }
 
-                // Capture Move
-                // Normal Captures
-                if(i>1 && valid_move(i-1,j-1) && chess_board[i-1][j-1] >= p && chess_board[i-1][j-1] <= k){
-                    possible_moves.add_move(encode_move_to_integer(i*16+j,(i-1)*16+j-1,0,1,0,0,0));
-                }
-                if(i>1 && valid_move(i-1,j+1) && chess_board[i-1][j+1] >= p && chess_board[i-1][j+1] <= k){
-                    possible_moves.add_move(encode_move_to_integer(i*16+j,(i-1)*16+j+1,0,1,0,0,0));
-                }
-                // Capture En-passant
-                if(valid_move(i-1,j-1) && chess_board[i][j-1] == p && enpassant == (i-1)*16+j-1){
-                    possible_moves.add_move(encode_move_to_integer(i*16+j,(i-1)*16+j-1,0,1,1,0,0));
-                }
-                if(valid_move(i-1,j+1) && chess_board[i][j+1] == p && enpassant == (i-1)*16+j+1){
-                    possible_moves.add_move(encode_move_to_integer(i*16+j,(i-1)*16+j+1,0,1,1,0,0));
-                }
-                // Capture Promotion
-                if(i==1 && valid_move(i-1,j-1) && chess_board[i-1][j-1] >= p && chess_board[i-1][j-1] <= k){
-                    possible_moves.add_move(encode_move_to_integer(i*16+j,(i-1)*16+j-1,Q,1,0,0,0));
-                    possible_moves.add_move(encode_move_to_integer(i*16+j,(i-1)*16+j-1,R,1,0,0,0));
-                    possible_moves.add_move(encode_move_to_integer(i*16+j,(i-1)*16+j-1,B,1,0,0,0));
-                    possible_moves.add_move(encode_move_to_integer(i*16+j,(i-1)*16+j-1,N,1,0,0,0));
-                }
-                if(i==1 && valid_move(i-1,j+1) && chess_board[i-1][j+1] >= p && chess_board[i-1][j+1] <= k){
-                    possible_moves.add_move(encode_move_to_integer(i*16+j,(i-1)*16+j+1,Q,1,0,0,0));
-                    possible_moves.add_move(encode_move_to_integer(i*16+j,(i-1)*16+j+1,R,1,0,0,0));
-                    possible_moves.add_move(encode_move_to_integer(i*16+j,(i-1)*16+j+1,B,1,0,0,0));
-                    possible_moves.add_move(encode_move_to_integer(i*16+j,(i-1)*16+j+1,N,1,0,0,0));
-                }
-            }
+    move_piece(pos, target, source);
 
-            // Black Pawn Moves
-            else if(side && chess_board[i][j] == p){
-                // Single Move
-                if(valid_move(i+1,j) && chess_board[i+1][j] == e){
-                    // Promotion
-                    if(i == 6){
-                        possible_moves.add_move(encode_move_to_integer(i*16+j,(i+1)*16+j,q,0,0,0,0));
-                        possible_moves.add_move(encode_move_to_integer(i*16+j,(i+1)*16+j,r,0,0,0,0));
-                        possible_moves.add_move(encode_move_to_integer(i*16+j,(i+1)*16+j,b,0,0,0,0));
-                        possible_moves.add_move(encode_move_to_integer(i*16+j,(i+1)*16+j,n,0,0,0,0));
-                    }
-                    else{
-                        possible_moves.add_move(encode_move_to_integer(i*16+j,(i+1)*16+j,0,0,0,0,0));
-                    }
-                }
+    // Put back the castled rook
+    if(castling){
+        switch(index_0x88(target)){
+            case g1: move_piece(pos, index_64(f1), index_64(h1)); break;
+            case c1: move_piece(pos, index_64(d1), index_64(a1)); break;
+            case g8: move_piece(pos, index_64(f8), index_64(h8)); break;
+            case c8: move_piece(pos, index_64(d8), index_64(a8)); break;
+        }
+    }
 
-                // Double Move
-                if(i == 1 && chess_board[i+1][j] == e && chess_board[i+2][j] == e){
-                    possible_moves.add_move(encode_move_to_integer(i*16+j,(i+2)*16+j,0,0,0,0,1));
-                }
+    // Put back the captured piece
+    if(enpassant_capture){
+        put_piece(pos, undo.captured, side == white ? target + 8 : target - 8);
+    }
+    else if(undo.captured != e){
+        put_piece(pos, undo.captured, target);
+    }
 
-                // Capture Move
-                // Normal Captures
-                if(i<6 && valid_move(i+1,j-1) && chess_board[i+1][j-1] >= P && chess_board[i+1][j-1] <= K){
-                    possible_moves.add_move(encode_move_to_integer(i*16+j,(i+1)*16+j-1,0,1,0,0,0));
-                }
-                if(i<6 && valid_move(i+1,j+1) && chess_board[i+1][j+1] >= P && chess_board[i+1][j+1] <= K){
-                    possible_moves.add_move(encode_move_to_integer(i*16+j,(i+1)*16+j+1,0,1,0,0,0));
-                }
-                // Capture En-passant
-                if(valid_move(i+1,j-1) && chess_board[i][j-1] == P && enpassant == (i+1)*16+j-1){
-                    possible_moves.add_move(encode_move_to_integer(i*16+j,(i+1)*16+j-1,0,1,1,0,0));
-                }
-                if(valid_move(i+1,j+1) && chess_board[i][j+1] == P && enpassant == (i+1)*16+j+1){
-                    possible_moves.add_move(encode_move_to_integer(i*16+j,(i+1)*16+j+1,0,1,1,0,0));
-                }
-                // Capture Promotion
-                if(i==6 && valid_move(i+1,j-1) && chess_board[i+1][j-1] >= P && chess_board[i+1][j-1] <= K){
-                    possible_moves.add_move(encode_move_to_integer(i*16+j,(i+1)*16+j-1,q,1,0,0,0));
-                    possible_moves.add_move(encode_move_to_integer(i*16+j,(i+1)*16+j-1,r,1,0,0,0));
-                    possible_moves.add_move(encode_move_to_integer(i*16+j,(i+1)*16+j-1,b,1,0,0,0));
-                    possible_moves.add_move(encode_move_to_integer(i*16+j,(i+1)*16+j-1,n,1,0,0,0));
-                }
-                if(i==6 && valid_move(i+1,j+1) && chess_board[i+1][j+1] >= P && chess_board[i+1][j+1] <= K){
-                    possible_moves.add_move(encode_move_to_integer(i*16+j,(i+1)*16+j+1,q,1,0,0,0));
-                    possible_moves.add_move(encode_move_to_integer(i*16+j,(i+1)*16+j+1,r,1,0,0,0));
-                    possible_moves.add_move(encode_move_to_integer(i*16+j,(i+1)*16+j+1,b,1,0,0,0));
-                    possible_moves.add_move(encode_move_to_integer(i*16+j,(i+1)*16+j+1,n,1,0,0,0));
-                }
-            }
+    pos.hash_key = undo.hash_key;
+}
 
-            // White Side King Castling
-            else if(!side && chess_board[i][j] == K){
-                // Check if castling option is available
-                // Check for empty squares between king and rook
-                // Check squares for king movement are not attacked
-                
-                // King Side Castling
-                if((castle & Kc) && chess_board[7][5] == e && chess_board[7][6] == e && !is_square_attacked(7,4,!side) && !is_square_attacked(7,5,!side) && !is_square_attacked(7,6,!side)){
-                    possible_moves.add_move(encode_move_to_integer(i*16+j,7*16+6,0,0,0,1,0));
-                }
-                // Queen Side Castling
-                if((castle & Qc) && chess_board[7][1] == e && chess_board[7][2] == e && chess_board[7][3] == e && !is_square_attacked(7,4,!side) && !is_square_attacked(7,3,!side) && !is_square_attacked(7,2,!side)){
-                    possible_moves.add_move(encode_move_to_integer(i*16+j,7*16+2,0,0,0,1,0));
-                }
-                // Non-Castling King Moves
-                for(int ind=0;ind<8;ind++){
-                    int tarx = i + king_moves[ind][0];
-                    int tary = j + king_moves[ind][1];
-
-                    // Normal Moves
-                    if(valid_move(tarx,tary) && !is_square_attacked(tarx,tary,!side) && chess_board[tarx][tary] == e){
-                        possible_moves.add_move(encode_move_to_integer(i*16+j,tarx*16+tary,0,0,0,0,0));
-                    }
-                    // Capture Moves
-                    if(valid_move(tarx,tary) && !is_square_attacked(tarx,tary,!side) && chess_board[tarx][tary] >= p && chess_board[tarx][tary] <= k){
-                        possible_moves.add_move(encode_move_to_integer(i*16+j,tarx*16+tary,0,1,0,0,0));
-                    }
-                }
-            }
+// Null Move
+// Pass the turn, only the side to move & en-passant square change
+// Resets the halfmove clock, a line with a null move in it is no real repetition
+void set_null_move(Position &pos, Undo &undo){
+    undo.enpassant = pos.enpassant;
+    undo.hash_key = pos.hash_key;
+    undo.halfmove_clock = pos.halfmove_clock;
+
+    if(pos.enpassant != no_sq) pos.hash_key ^= enpassant_keys[pos.enpassant % 16];
+    pos.enpassant = no_sq;
+
+    pos.side_to_move = !pos.side_to_move;
+    pos.hash_key ^= side_key;
+    pos.halfmove_clock = 0;
+    pos.key_history[pos.key_count++] = pos.hash_key;
+}
 
-            // Black Side King Castling
-            else if(side && chess_board[i][j] == k){
-                // King Side Castling
-                if((castle & kc) && chess_board[0][5] == e && chess_board[0][6] == e && !is_square_attacked(0,4,!side) && !is_square_attacked(0,5,!side) && !is_square_attacked(0,6,!side)){
-                    possible_moves.add_move(encode_move_to_integer(i*16+j,6,0,0,0,1,0));
-                }
-                // Queen Side Castling
-                if((castle & qc) && chess_board[0][1] == e && chess_board[0][2] == e && chess_board[0][3] == e && !is_square_attacked(0,4,!side) && !is_square_attacked(0,3,!side) && !is_square_attacked(0,2,!side)){
-                    possible_moves.add_move(encode_move_to_integer(i*16+j,2,0,0,0,1,0));
-                }
-                // Non-Castling King Moves
-                for(int ind=0;ind<8;ind++){
-                    int tarx = i + king_moves[ind][0];
-                    int tary = j + king_moves[ind][1];
-
-                    // Normal Moves
-                    if(valid_move(tarx,tary) && !is_square_attacked(tarx,tary,!side) && chess_board[tarx][tary] == e){
-                        possible_moves.add_move(encode_move_to_integer(i*16+j,tarx*16+tary,0,0,0,0,0));
-                    }
-                    // Capture Moves
-                    if(valid_move(tarx,tary) && !is_square_attacked(tarx,tary,!side) && chess_board[tarx][tary] >= P && chess_board[tarx][tary] <= K){
-                        possible_moves.add_move(encode_move_to_integer(i*16+j,tarx*16+tary,0,1,0,0,0));
-                    }
-                }
-            }
+void unmake_null_move(Position &pos, Undo &undo){
+    pos.side_to_move = !pos.side_to_move;
+    pos.enpassant = undo.enpassant;
+    pos.hash_key = undo.hash_key;
+    pos.halfmove_clock = undo.halfmove_clock;
+    pos.key_count--;
+}
 
-            // White Knight Moves
-            else if(!side && chess_board[i][j] == N){
-                for(int ind=0;ind<8;ind++){
-                    int tarx = i + knight_moves[ind][0];
-                    int tary = j + knight_moves[ind][1];
-
-                    // Normal Moves
-                    if(valid_move(tarx,tary) && chess_board[tarx][tary] == e){
-                        possible_moves.add_move(encode_move_to_integer(i*16+j,tarx*16+tary,0,0,0,0,0));
-                    }
-                    // Capture Moves
-                    if(valid_move(tarx,tary) && chess_board[tarx][tary] >= p && chess_board[tarx][tary] <= k){
-                        possible_moves.add_move(encode_move_to_integer(i*16+j,tarx*16+tary,0,1,0,0,0));
-                    }
-                }
-            }
+// Repetitions
+// True if the position occurred at least count times before, only the keys since the last irreversible move are
+// scanned & only every second one, the side to move has to be the same
+bool is_repetition(Position &pos, int count = 1){
+    int oldest = max(0, pos.key_count - 1 - pos.halfmove_clock);
+    for(int i=pos.key_count-3;i>=oldest;i-=2){
+        if(pos.key_history[i] == pos.hash_key && --count == 0) return true;
+    }
+    return false;
+}
 
-            // Black Knight Moves
-            else if(side && chess_board[i][j] == n){
-                for(int ind=0;ind<8;ind++){
-                    int tarx = i + knight_moves[ind][0];
-                    int tary = j + knight_moves[ind][1];
-
-                    // Normal Moves
-                    if(valid_move(tarx,tary) && chess_board[tarx][tary] == e){
-                        possible_moves.add_move(encode_move_to_integer(i*16+j,tarx*16+tary,0,0,0,0,0));
-                    }
-                    // Capture Moves
-                    if(valid_move(tarx,tary) && chess_board[tarx][tary] >= P && chess_board[tarx][tary] <= K){
-                        possible_moves.add_move(encode_move_to_integer(i*16+j,tarx*16+tary,0,1,0,0,0));
-                    }
-                }
+// Drop the keys before the last irreversible move (or 100 plies back, the game is drawn by then), they can't repeat
+// Called by game drivers after every played move, so key_history never overflows however long the game
+void trim_key_history(Position &pos){
+    int keep = min(pos.key_count, min(pos.halfmove_clock, 100) + 1);
+    memmove(pos.key_history, pos.key_history + pos.key_count - keep, keep * sizeof(U64));
+    pos.key_count = keep;
+}
+
+// Add all moves of a piece from source to the target squares, flagging captures
+void add_piece_moves(Position &pos, int source, U64 targets, Moves &possible_moves){
+    int side = pos.side_to_move;
+    while(targets){
+        int target = pop_lsb(targets);
+        int capture = (pos.occupancies[!side] & square_bit(target)) != 0;
+        possible_moves.add_move(encode_move_to_integer(index_0x88(source),index_0x88(target),0,capture,0,0,0));
+    }
+}
+
+// Add pawn move, expanding it into the four promotions on the last rank
+void add_pawn_move(int side, int source, int target, int capture, Moves &possible_moves){
+    if(target < 8 || target >= 56){
+        possible_moves.add_move(encode_move_to_integer(index_0x88(source),index_0x88(target),Q + 6*side,capture,0,0,0));
+        possible_moves.add_move(encode_move_to_integer(index_0x88(source),index_0x88(target),R + 6*side,capture,0,0,0));
+        possible_moves.add_move(encode_move_to_integer(index_0x88(source),index_0x88(target),B + 6*side,capture,0,0,0));
+        possible_moves.add_move(encode_move_to_integer(index_0x88(source),index_0x88(target),N + 6*side,capture,0,0,0));
+    }
+    else{
+        possible_moves.add_move(encode_move_to_integer(index_0x88(source),index_0x88(target),0,capture,0,0,0));
+    }
+}
+
+// Own pieces pinned to the king of side, the only piece between the king & an enemy slider on its line
+U64 pinned_pieces(Position &pos, int side){
+    int king = lsb_index(pos.bitboards[K + 6*side]);
+    int enemy = !side;
+    U64 snipers = (bishop_attacks(king, 0ULL) & (pos.bitboards[B + 6*enemy] | pos.bitboards[Q + 6*enemy]))
+                | (rook_attacks(king, 0ULL) & (pos.bitboards[R + 6*enemy] | pos.bitboards[Q + 6*enemy]));
+    U64 pinned = 0ULL;
+    while(snipers){
+        U64 blockers = between_squares[king][pop_lsb(snipers)] & pos.occupancies[both];
+        if(count_bits(blockers) == 1) pinned |= blockers & pos.occupancies[side];
+    }
+    return pinned;
+}
+
+// Generate moves for side to move
+// Pseudo legal by default, moves leaving own king in check are rejected by set_move
+// legal -> only legal moves, which can be played with make_move
+//     Checkers & pinned pieces are found once, in double check only the king moves,
+//     in single check other pieces have to capture the checker or block (check_mask),
+//     a pinned piece stays on the line through king & pinner, the king only moves to unattacked squares
+//     & en-passant is tested on the board after it, as it removes two pieces from the king's lines
+// captures_only -> only captures & promotions, for quiescence search
+void generate_moves(Position &pos, Moves &possible_moves, bool captures_only = false, bool legal = false){
+    int side = pos.side_to_move;
+    U64 own = pos.occupancies[side], enemy = pos.occupancies[!side], occupied = pos.occupancies[both];
+    U64 targets = captures_only ? enemy : ~own;
+
+    // Legal move masks, all squares allowed for pseudo legal moves
+    int king = lsb_index(pos.bitboards[K + 6*side]);
+    U64 checkers = 0ULL, check_mask = ~0ULL, pinned = 0ULL;
+    if(legal){
+        checkers = attackers_to(pos, king, occupied) & enemy;
+        if(checkers) check_mask = checkers | between_squares[king][lsb_index(checkers)];
+        pinned = pinned_pieces(pos, side);
+
+        // King Moves, squares attacked once the king has left its square are off limits too
+        U64 king_targets = king_attacks[king] & targets, safe = 0ULL;
+        while(king_targets){
+            int target = pop_lsb(king_targets);
+            if(!(attackers_to(pos, target, occupied ^ square_bit(king)) & enemy)) safe |= square_bit(target);
+        }
+        add_piece_moves(pos, king, safe, possible_moves);
+
+        // Double Check
+        if(count_bits(checkers) > 1) return;
+    }
+    targets &= check_mask;
+
+    // Pawn Moves
+    // White pawns move towards rank index 0, black pawns towards rank index 7
+    int forward = side == white ? -8 : 8;
+    int start_rank = side == white ? 6 : 1;
+    U64 pawns = pos.bitboards[P + 6*side];
+    while(pawns){
+        int source = pop_lsb(pawns);
+        int target = source + forward;
+        U64 allowed = (pinned & square_bit(source)) ? line_through[king][source] & check_mask : check_mask;
+
+        // Single Move & Promotion
+        if(!(occupied & square_bit(target)) && (!captures_only || target < 8 || target >= 56)){
+            if(allowed & square_bit(target)) add_pawn_move(side, source, target, 0, possible_moves);
+
+            // Double Move
+            if(!captures_only && source/8 == start_rank && !(occupied & square_bit(target + forward)) && (allowed & square_bit(target + forward))){
+                possible_moves.add_move(encode_move_to_integer(index_0x88(source),index_0x88(target + forward),0,0,0,0,1));
             }
+        }
 
-            // White Bishop & Queen Moves
-            if(!side && (chess_board[i][j] == B || chess_board[i][j] == Q)){
-                for(int ind=0;ind<4;ind++){
-                    int tarx = i + bishop_offsets[ind][0];
-                    int tary = j + bishop_offsets[ind][1];
-                    while(valid_move(tarx,tary)){
-                        // Normal Moves
-                        if(chess_board[tarx][tary] == e){
-                            possible_moves.add_move(encode_move_to_integer(i*16+j,tarx*16+tary,0,0,0,0,0));
-                        }
-                        // Capture Moves
-                        if(chess_board[tarx][tary] >= p && chess_board[tarx][tary] <= k){
-                            possible_moves.add_move(encode_move_to_integer(i*16+j,tarx*16+tary,0,1,0,0,0));
-                            break;
-                        }
-                        // Break if any there is any chess piece in between
-                        if(chess_board[tarx][tary] != e) break;
-
-                        tarx = tarx + bishop_offsets[ind][0];
-                        tary = tary + bishop_offsets[ind][1];
-                    }
-                }
+        // Normal Captures & Capture Promotion
+        U64 captures = pawn_attacks[side][source] & enemy & allowed;
+        while(captures){
+            add_pawn_move(side, source, pop_lsb(captures), 1, possible_moves);
+        }
+
+        // Capture En-passant
+        if(pos.enpassant != no_sq && (pawn_attacks[side][source] & square_bit(index_64(pos.enpassant)))){
+            int enpassant_target = index_64(pos.enpassant), captured = enpassant_target - forward;
+            U64 after = (occupied ^ square_bit(source) ^ square_bit(captured)) | square_bit(enpassant_target);
+            if(!legal || !(attackers_to(pos, king, after) & enemy & ~square_bit(captured))){
+                possible_moves.add_move(encode_move_to_integer(index_0x88(source),pos.enpassant,0,1,1,0,0));
             }
+        }
+    }
+
+    // Castling
+    // Check if castling option is available
+    // Check for empty squares between king and rook
+    // Check squares for king movement are not attacked
+    if(captures_only || checkers){
+        // No castling
+    }
+    else if(side == white){
+        // King Side Castling
+        if((pos.castle & Kc) && !(occupied & (square_bit(index_64(f1)) | square_bit(index_64(g1)))) && !is_square_attacked(pos,index_64(e1),black) && !is_square_attacked(pos,index_64(f1),black) && !is_square_attacked(pos,index_64(g1),black)){
+            possible_moves.add_move(encode_move_to_integer(e1,g1,0,0,0,1,0));
+        }
+        // Queen Side Castling
+        if((pos.castle & Qc) && !(occupied & (square_bit(index_64(b1)) | square_bit(index_64(c1)) | square_bit(index_64(d1)))) && !is_square_attacked(pos,index_64(e1),black) && !is_square_attacked(pos,index_64(d1),black) && !is_square_attacked(pos,index_64(c1),black)){
+            possible_moves.add_move(encode_move_to_integer(e1,c1,0,0,0,1,0));
+        }
+    }
+    else{
+        // King Side Castling
+        if((pos.castle & kc) && !(occupied & (square_bit(index_64(f8)) | square_bit(index_64(g8)))) && !is_square_attacked(pos,index_64(e8),white) && !is_square_attacked(pos,index_64(f8),white) && !is_square_attacked(pos,index_64(g8),white)){
+            possible_moves.add_move(encode_move_to_integer(e8,g8,0,0,0,1,0));
+        }
+        // Queen Side Castling
+        if((pos.castle & qc) && !(occupied & (square_bit(index_64(b8)) | square_bit(index_64(c8)) | square_bit(index_64(d8)))) && !is_square_attacked(pos,index_64(e8),white) && !is_square_attacked(pos,index_64(d8),white) && !is_square_attacked(pos,index_64(c8),white)){
+            possible_moves.add_move(encode_move_to_integer(e8,c8,0,0,0,1,0));
+        }
+    }
+
+    // Knight Moves
+    U64 knights = pos.bitboards[N + 6*side];
+    while(knights){
+        int source = pop_lsb(knights);
+        U64 allowed = (pinned & square_bit(source)) ? line_through[king][source] : ~0ULL;
+        add_piece_moves(pos, source, knight_attacks[source] & targets & allowed, possible_moves);
+    }
+
+    // Bishop Moves
+    U64 bishops = pos.bitboards[B + 6*side];
+    while(bishops){
+        int source = pop_lsb(bishops);
+        U64 allowed = (pinned & square_bit(source)) ? line_through[king][source] : ~0ULL;
+        add_piece_moves(pos, source, bishop_attacks(source, occupied) & targets & allowed, possible_moves);
+    }
+
+    // Rook Moves
+    U64 rooks = pos.bitboards[R + 6*side];
+    while(rooks){
+        int source = pop_lsb(rooks);
+        U64 allowed = (pinned & square_bit(source)) ? line_through[king][source] : ~0ULL;
+        add_piece_moves(pos, source, rook_attacks(source, occupied) & targets & allowed, possible_moves);
+    }
+
+    // Queen Moves
+    U64 queens = pos.bitboards[Q + 6*side];
+    while(queens){
+        int source = pop_lsb(queens);
+        U64 allowed = (pinned & square_bit(source)) ? line_through[king][source] : ~0ULL;
+        add_piece_moves(pos, source, queen_attacks(source, occupied) & targets & allowed, possible_moves);
+    }
+
+    // Non-Castling King Moves, already added when legal
+    U64 kings = legal ? 0ULL : pos.bitboards[K + 6*side];
+    while(kings){
+        int source = pop_lsb(kings);
+        add_piece_moves(pos, source, king_attacks[source] & targets, possible_moves);
+    }
+}
+
+#define MAX_DEPTH 64
+#define MAX_PLY 128
+
+// Search scores are negamax, for the side to move
+// Being mated at ply scores -(MATE_SCORE - ply), so shorter mates score higher
+// Scores beyond MATE_BOUND are mates, INF_SCORE is outside every possible score
+#define MATE_SCORE 100000
+#define MATE_BOUND (MATE_SCORE - MAX_PLY)
+#define INF_SCORE 1000000
+
+class TranspositionTable;
+
+// Search Options
+// Settings of one search, independent searches in one process can each use their own table & tuning
+// table -> transposition table shared by the threads of the search
+// null_move_reduction -> depth reduction of the null move search, 0 disables null move pruning
+// lmr_full_depth_moves -> moves searched to full depth before late move reductions start, 0 disables them
+struct SearchOptions{
+    int threads;
+    int null_move_reduction;
+    int lmr_full_depth_moves;
+    TranspositionTable *table;
+};
+
+// Search Context
+// Everything a search thread writes while searching, threads only share the transposition table
+struct SearchContext{
+    Position pos;
+    SearchOptions options;
+    atomic<long long> nodes;    // Written by the owning thread only, atomic so the main thread can sum it while searching
+    atomic<bool> *stop;         // Shared by all threads of a search, set to make them unwind
+
+    // Limits checked by every thread, -1 -> none, the node limit counts the nodes of all threads
+    long long time_limit;       // ms
+    long long node_limit;
+    chrono::steady_clock::time_point start_time;
+    long long next_check;       // Node count of the next limit check
+    SearchContext *threads;     // Contexts of all threads of the search, for the node limit
+    int thread_count;
+
+    // Move ordering, killer_moves[slot][ply] & history_moves[side][source][target] (bitboard squares)
+    int killer_moves[2][MAX_PLY];
+    int history_moves[2][64][64];
+
+    // Beta cutoffs & how many of them came from the first legal move
+    long long cutoffs;
+    long long first_move_cutoffs;
+
+    // Nodes searched by quiescence_search, included in nodes
+    long long quiescence_nodes;
+
+    // Triangular PV table, pv_table[ply][ply ... pv_length[ply] - 1] -> best line found from the node at ply
+    // A node copies its child's line behind the move raising alpha, the root's line is the principal variation
+    int pv_table[MAX_PLY + 1][MAX_PLY + 1];
+    int pv_length[MAX_PLY + 1];
+};
+
+// New line at ply, move followed by the line of the child node
+void update_pv(SearchContext &search, int move, int ply){
+    search.pv_table[ply][ply] = move;
+    for(int i=ply+1;i<search.pv_length[ply+1];i++) search.pv_table[ply][i] = search.pv_table[ply+1][i];
+    search.pv_length[ply] = max(search.pv_length[ply+1], ply+1);
+}
+
+void check_limits(SearchContext &search);
+
+// Count a node of find_best_move or quiescence_search & check the limits when next_check is reached
+// Only the owning thread writes so no atomic read-modify-write is needed
+void count_node(SearchContext &search){
+    long long nodes = search.nodes.load(memory_order_relaxed) + 1;
+    search.nodes.store(nodes, memory_order_relaxed);
+    if(nodes >= search.next_check) check_limits(search);
+}
+
+long long elapsed_ms(chrono::steady_clock::time_point start_time){
+    return chrono::duration_cast<chrono::milliseconds>(chrono::steady_clock::now() - start_time).count();
+}
+
+// Stop all threads of the search once the time or node budget is used up
+// Checks again after 2048 more nodes of this thread, or sooner when all threads together get close to the node limit
+void check_limits(SearchContext &search){
+    long long own_nodes = search.nodes.load(memory_order_relaxed), nodes = 0;
+    if(search.node_limit >= 0){
+        for(int i=0;i<search.thread_count;i++) nodes += search.threads[i].nodes.load(memory_order_relaxed);
+    }
+
+    if((search.time_limit >= 0 && elapsed_ms(search.start_time) >= search.time_limit) || (search.node_limit >= 0 && nodes >= search.node_limit)){
+        search.stop->store(true, memory_order_relaxed);
+    }
+
+    search.next_check = own_nodes + 2048;
+    if(search.node_limit >= 0) search.next_check = min(search.next_check, own_nodes + max(1LL, (search.node_limit - nodes) / search.thread_count));
+}
+
+// Move Ordering
+// Hash move, then captures by MVV-LVA (most valuable victim, least valuable attacker), queen promotions,
+// killer moves of the ply, quiet moves by history score and finally captures losing material by SEE
+int piece_rank[14] = {0, 0, 1, 3, 2, 4, 5, 6, 1, 3, 2, 4, 5, 6};
+
+int score_move(SearchContext &search, int move, int hash_move, int ply){
+    if(move == hash_move) return 30000000;
+
+    Position &pos = search.pos;
+    int source = index_64(source_square(move)), target = index_64(target_square(move));
+    if(capture_flag(move)){
+        int victim = enpassant_flag(move) ? P : pos.board[target];
+
+        // Only a capture by a more valuable piece can lose material
+        if(piece_rank[pos.board[source]] > piece_rank[victim]){
+            int exchange = see(pos, move);
+            if(exchange < 0) return exchange;
+        }
+        return 20000000 + piece_rank[victim] * 10 - piece_rank[pos.board[source]];
+    }
+    if(promoted_piece(move) == Q || promoted_piece(move) == q) return 19000000;
+    if(move == search.killer_moves[0][ply]) return 18000000;
+    if(move == search.killer_moves[1][ply]) return 17000000;
+    return search.history_moves[pos.side_to_move][source][target];
+}
+
+// A quiet move caused a beta cutoff, try it early in sibling nodes (killers) & everywhere else (history)
+void update_quiet_cutoff(SearchContext &search, int move, int depth, int ply){
+    if(capture_flag(move) || promoted_piece(move)) return;
+
+    if(search.killer_moves[0][ply] != move){
+        search.killer_moves[1][ply] = search.killer_moves[0][ply];
+        search.killer_moves[0][ply] = move;
+    }
+
+    int side = search.pos.side_to_move;
+    int &history = search.history_moves[side][index_64(source_square(move))][index_64(target_square(move))];
+    history += depth * depth;
+
+    // Age all scores so history stays below the killer scores
+    if(history > 1000000){
+        for(int source=0;source<64;source++){
+            for(int target=0;target<64;target++) search.history_moves[side][source][target] /= 2;
+        }
+    }
+}
+
+// Quiescence Search
+// Only captures & queen promotions are searched past the horizon, until the position is quiet
+// Stand pat -> the side to move can refuse all captures, so the static evaluation is a bound on the score
+// Delta pruning -> skip captures that can't lift the score back to alpha even when winning the piece for free
+// Bad captures -> skip captures losing material by SEE, move ordering already scored them below 0
+#define DELTA_MARGIN 200
+
+// Static evaluation for the side to move
+int evaluate_side_to_move(Position &pos){
+    return pos.side_to_move == white ? evaluate_position(pos) : -evaluate_position(pos);
+}
+
+int quiescence_search(SearchContext &search, int ply, int alpha, int beta){
+    Position &pos = search.pos;
+    search.pv_length[ply] = ply;
+    count_node(search);
+    search.quiescence_nodes++;
+
+    int stand_pat = evaluate_side_to_move(pos);
+    if(ply >= MAX_PLY) return stand_pat;
+
+    // Stand pat cutoff
+    if(stand_pat >= beta) return stand_pat;
+    alpha = max(alpha, stand_pat);
+
+    int side = pos.side_to_move;
+    Moves possible_moves;
+    generate_moves(pos, possible_moves, true, true);
 
-            // Black Bishop & Queen Moves
-            else if(side && (chess_board[i][j] == b || chess_board[i][j] == q)){
-                for(int ind=0;ind<4;ind++){
-                    int tarx = i + bishop_offsets[ind][0];
-                    int tary = j + bishop_offsets[ind][1];
-                    while(valid_move(tarx,tary)){
-                        // Normal Moves
-                        if(chess_board[tarx][tary] == e){
-                            possible_moves.add_move(encode_move_to_integer(i*16+j,tarx*16+tary,0,0,0,0,0));
-                        }
-                        // Capture Moves
-                        if(chess_board[tarx][tary] >= P && chess_board[tarx][tary] <= K){
-                            possible_moves.add_move(encode_move_to_integer(i*16+j,tarx*16+tary,0,1,0,0,0));
-                            break;
-                        }
-                        // Break if any there is any chess piece in between
-                        if(chess_board[tarx][tary] != e) break;
-
-                        tarx = tarx + bishop_offsets[ind][0];
-                        tary = tary + bishop_offsets[ind][1];
-                    }
+    int count = possible_moves.get_count();
+    for(int i=0;i<count;i++) possible_moves.set_score(i, score_move(search, possible_moves.get_move(i), 0, ply));
+
+    Undo undo;
+    int best_score = stand_pat;
+
+    for(int i=0;i<count;i++){
+        possible_moves.pick_next_move(i);
+        int move = possible_moves.get_move(i);
+        int promoted = promoted_piece(move);
+        if(promoted && promoted != Q + 6*side) continue;
+
+        // Delta Pruning
+        int victim = enpassant_flag(move) ? P : pos.board[index_64(target_square(move))];
+        if(!promoted && stand_pat + abs(piece_value[victim]) + DELTA_MARGIN <= alpha) continue;
+
+        // Skip Bad Captures
+        if(!promoted && possible_moves.get_score(i) < 0) continue;
+
+        // Only legal moves are generated
+        make_move(pos, move, undo);
+
+        // Score of the other side, negated
+        int score = -quiescence_search(search, ply+1, -beta, -alpha);
+
+        // Take the move back for next possible move evaluation
+        unmake_move(pos, move, undo);
+
+        if(score > best_score) best_score = score;
+
+        // Alpha Beta Pruning
+        alpha = max(alpha, best_score);
+        if(alpha >= beta) break;
+    }
+
+    return best_score;
+}
+
+
+// Transposition Table
+// Buckets of 4 entries fill one 64 byte cache line, the table size is a power of two number of buckets
+// Each entry stores (hash key ^ data) and data, so an entry torn by concurrent writes from another thread
+// fails the key check on probe instead of returning wrong data (lockless hashing)
+// data -> move (22 bits) | bound (2 bits) | depth (8 bits) | score (32 bits)
+enum tt_bounds {tt_exact = 1, tt_lower, tt_upper};
+
+struct TTEntry{
+    atomic<U64> key;
+    atomic<U64> data;
+};
+
+struct alignas(64) TTBucket{
+    TTEntry entries[4];
+};
+
+// Unpacked entry returned by probe
+struct TTData{
+    int move;
+    int bound;
+    int depth;
+    int score;
+};
+
+class TranspositionTable{
+    private:
+        TTBucket *buckets;
+        U64 bucket_count;
+    public:
+        // Statistics, relaxed atomics so threads sharing the table can update them
+        atomic<U64> hits, misses, overwrites;
+
+        // size_mb 0 -> no buckets until resize is called, the table can't be used before
+        TranspositionTable(int size_mb = 16){
+            buckets = nullptr;
+            bucket_count = 0;
+            if(size_mb > 0) resize(size_mb);
+        }
+        ~TranspositionTable(){
+            delete[] buckets;
+        }
+        // Allocate the largest power of two number of buckets fitting in size_mb
+        void resize(int size_mb){
+            U64 count = 1;
+            while(count * 2 * sizeof(TTBucket) <= (U64)max(size_mb, 1) * 1024 * 1024) count *= 2;
+            delete[] buckets;
+            buckets = new TTBucket[count];
+            bucket_count = count;
+            clear();
+        }
+        void clear(){
+            for(U64 i=0;i<bucket_count;i++){
+                for(int j=0;j<4;j++){
+                    buckets[i].entries[j].key.store(0, memory_order_relaxed);
+                    buckets[i].entries[j].data.store(0, memory_order_relaxed);
                 }
             }
-
-            // White Rook & Queen Moves
-            if(!side && (chess_board[i][j] == R || chess_board[i][j] == Q)){
-                for(int ind=0;ind<4;ind++){
-                    int tarx = i + rook_offsets[ind][0];
-                    int tary = j + rook_offsets[ind][1];
-                    while(valid_move(tarx,tary)){
-                        // Normal Moves
-                        if(chess_board[tarx][tary] == e){
-                            possible_moves.add_move(encode_move_to_integer(i*16+j,tarx*16+tary,0,0,0,0,0));
-                        }
-                        // Capture Moves
-                        if(chess_board[tarx][tary] >= p && chess_board[tarx][tary] <= k){
-                            possible_moves.add_move(encode_move_to_integer(i*16+j,tarx*16+tary,0,1,0,0,0));
-                            break;
-                        }
-                        // Break if any there is any chess piece in between
-                        if(chess_board[tarx][tary] != e) break;
-
-                        tarx = tarx + rook_offsets[ind][0];
-                        tary = tary + rook_offsets[ind][1];
-                    }
+            hits = misses = overwrites = 0;
+        }
+        bool probe(U64 key, TTData &entry){
+            TTBucket &bucket = buckets[key & (bucket_count - 1)];
+            for(int j=0;j<4;j++){
+                U64 data = bucket.entries[j].data.load(memory_order_relaxed);
+                if(data && (bucket.entries[j].key.load(memory_order_relaxed) ^ data) == key){
+                    entry.move = data & 0x3FFFFF;
+                    entry.bound = (data >> 22) & 3;
+                    entry.depth = (data >> 24) & 0xFF;
+                    entry.score = (int)(unsigned int)(data >> 32);
+                    hits.fetch_add(1, memory_order_relaxed);
+                    return true;
                 }
             }
-
-            // Black Rook & Queen Moves
-            else if(side && (chess_board[i][j] == r || chess_board[i][j] == q)){
-                for(int ind=0;ind<4;ind++){
-                    int tarx = i + rook_offsets[ind][0];
-                    int tary = j + rook_offsets[ind][1];
-                    while(valid_move(tarx,tary)){
-                        // Normal Moves
-                        if(chess_board[tarx][tary] == e){
-                            possible_moves.add_move(encode_move_to_integer(i*16+j,tarx*16+tary,0,0,0,0,0));
-                        }
-                        // Capture Moves
-                        if(chess_board[tarx][tary] >= P && chess_board[tarx][tary] <= K){
-                            possible_moves.add_move(encode_move_to_integer(i*16+j,tarx*16+tary,0,1,0,0,0));
-                            break;
-                        }
-                        // Break if any there is any chess piece in between
-                        if(chess_board[tarx][tary] != e) break;
-
-                        tarx = tarx + rook_offsets[ind][0];
-                        tary = tary + rook_offsets[ind][1];
-                    }
+            misses.fetch_add(1, memory_order_relaxed);
+            return false;
+        }
+        // Replace the entry of the same position, else an empty entry, else the shallowest one
+        void store(U64 key, int move, int bound, int depth, int score){
+            TTBucket &bucket = buckets[key & (bucket_count - 1)];
+            int replace = 0, replace_depth = INT_MAX;
+            for(int j=0;j<4;j++){
+                U64 data = bucket.entries[j].data.load(memory_order_relaxed);
+                if(!data || (bucket.entries[j].key.load(memory_order_relaxed) ^ data) == key){
+                    replace = j;
+                    replace_depth = -1;
+                    break;
+                }
+                if((int)((data >> 24) & 0xFF) < replace_depth){
+                    replace = j;
+                    replace_depth = (data >> 24) & 0xFF;
                 }
             }
+            if(replace_depth >= 0) overwrites.fetch_add(1, memory_order_relaxed);
+
+            U64 data = (U64)(move & 0x3FFFFF) | ((U64)bound << 22) | ((U64)min(depth, 255) << 24) | ((U64)(unsigned int)score << 32);
+            bucket.entries[replace].data.store(data, memory_order_relaxed);
+            bucket.entries[replace].key.store(key ^ data, memory_order_relaxed);
+        }
+        U64 size_mb(){
+            return bucket_count * sizeof(TTBucket) / (1024 * 1024);
+        }
+};
+
+// Table of the command line & UCI engine, sized by main (-hash, default 16 MB), so a library build that never
+// runs main doesn't allocate it, library engines have their own tables
+TranspositionTable transposition_table(0);
+
+// Bound type of a search result from the window it was searched with
+int tt_bound(int score, int alpha, int beta){
+    if(score <= alpha) return tt_upper;
+    if(score >= beta) return tt_lower;
+    return tt_exact;
+}
+
+// Mate scores are stored relative to the stored node instead of the root,
+// so a mate found through a transposition keeps the right distance at another ply
+int score_to_tt(int score, int ply){
+    if(score > MATE_BOUND) return score + ply;
+    if(score < -MATE_BOUND) return score - ply;
+    return score;
+}
+
+int score_from_tt(int score, int ply){
+    if(score > MATE_BOUND) return score - ply;
+    if(score < -MATE_BOUND) return score + ply;
+    return score;
+}
 
-            // Update king square
-            if(chess_board[i][j] == K) king_track[0] = i*16+j;
-            if(chess_board[i][j] == k) king_track[1] = i*16+j;
+// Late move reductions by remaining depth & move number, grows with both
+int lmr_reductions[MAX_DEPTH + 1][MAX_MOVES];
 
+void init_search_tables(){
+    for(int depth=1;depth<=MAX_DEPTH;depth++){
+        for(int move_number=1;move_number<MAX_MOVES;move_number++){
+            lmr_reductions[depth][move_number] = (int)(0.75 + log(depth) * log(move_number) / 2.25);
         }
     }
 }
 
-// Quiescence Search
-int quiescence_search(int side, int depth, int alpha, int beta){
-    int eval = evaluate_position();
-    if(depth == 0) return eval;
+// Side has only pawns & king left, passing may be the best move there so a null move search is unreliable
+bool zugzwang_prone(Position &pos, int side){
+    return !(pos.occupancies[side] & ~(pos.bitboards[P + 6*side] | pos.bitboards[K + 6*side]));
+}
+
+// Recursion Logic to find best move
+// Negamax alpha-beta with Principal Variation Search
+// The first move is searched with the full window, the rest with a null window (alpha, alpha + 1) that only proves
+// them no better than alpha, a move failing high is searched again with the full window
+// Null move pruning -> if passing the turn still fails high in a reduced search, so will the real moves
+// Late move reductions -> quiet moves late in the ordering rarely cut, they get a shallower null window search
+// and are searched to full depth only if that beats alpha
+// allow_null is false right after a null move, so two null moves never follow each other
+// Returns 0 without storing anything once the search is stopped, the caller has to discard the result then
+int find_best_move(SearchContext &search, int depth, int ply, int alpha, int beta, bool allow_null = true){
+    Position &pos = search.pos;
+    search.pv_length[ply] = ply;
+    if(search.stop->load(memory_order_relaxed)) return 0;
+
+    // Resolve captures at the horizon
+    if(depth <= 0) return quiescence_search(search, ply, alpha, beta);
+
+    count_node(search);
+
+    // Draw by the fifty-move rule or by repeating a position of the game or the search path
+    // One repetition is enough, whatever can be played once can be played again
+    if(ply > 0 && (pos.halfmove_clock >= 100 || is_repetition(pos))) return 0;
+    if(ply >= MAX_PLY) return evaluate_side_to_move(pos);
+
+    // Transposition table cutoff if this position was already searched deep enough
+    // Only in zero window nodes, a PV node (the root included) has to search on to fill its principal variation
+    TTData entry;
+    int hash_move = 0;
+    bool pv_node = beta - alpha > 1;
+    if(search.options.table->probe(pos.hash_key, entry)){
+        hash_move = entry.move;
+        int score = score_from_tt(entry.score, ply);
+        if(!pv_node && entry.depth >= depth && (entry.bound == tt_exact || (entry.bound == tt_lower && score >= beta) || (entry.bound == tt_upper && score <= alpha))){
+            return score;
+        }
+    }
+    int alpha_original = alpha;
+
+    int side = pos.side_to_move;
+    bool checked = in_check(pos, side);
+    Undo undo;
+
+    // Null Move Pruning
+    int null_move_reduction = search.options.null_move_reduction, lmr_full_depth_moves = search.options.lmr_full_depth_moves;
+    if(null_move_reduction > 0 && allow_null && !pv_node && !checked && ply > 0 && depth >= 3 && !zugzwang_prone(pos, side) && evaluate_side_to_move(pos) >= beta){
+        set_null_move(pos, undo);
+        int score = -find_best_move(search, depth - 1 - null_move_reduction, ply+1, -beta, -beta+1, false);
+        unmake_null_move(pos, undo);
+        if(search.stop->load(memory_order_relaxed)) return 0;
+
+        // Mates found after passing aren't proven
+        if(score >= beta) return score > MATE_BOUND ? beta : score;
+    }
 
     Moves possible_moves;
-    generate_moves(side, possible_moves);
-
-    // Keep an original board copy
-    int chess_board_copy[8][16];
-    copy(&chess_board[0][0], &chess_board[0][0] + 8*16, &chess_board_copy[0][0]);
-    int castle_copy = castle;
-    int enpassant_copy = enpassant;
-    side_to_move = side;
-    int king_track_copy[2];
-    copy(&king_track[0], &king_track[0] + 2, &king_track_copy[0]);
-
-    if(!side){ // White to move
-        int best_score = eval;
-
-        int count = possible_moves.get_count();
-        vector<int> moves = possible_moves.get_all_moves();
-
-        for(int i=0;i<count;i++){
-            // Check legal move & also sets the move if legal
-            if(!capture_flag(moves[i]) || !set_move(moves[i])){
-                copy(&chess_board_copy[0][0], &chess_board_copy[0][0] + 8*16, &chess_board[0][0]);
-                castle = castle_copy;
-                enpassant = enpassant_copy;
-                side_to_move = side;
-                copy(&king_track_copy[0], &king_track_copy[0] + 2, &king_track[0]);
-                continue;
-            }
+    generate_moves(pos, possible_moves, false, true);
+
+    int count = possible_moves.get_count();
+    for(int i=0;i<count;i++) possible_moves.set_score(i, score_move(search, possible_moves.get_move(i), hash_move, ply));
+
+    int best_score = -INF_SCORE;
+    int best_move = 0;
+    int legal_moves = 0;
+
+    for(int i=0;i<count;i++){
+        possible_moves.pick_next_move(i);
+        int move = possible_moves.get_move(i);
 
-            // Find best move for the other side and thus the evaluation
-            int score = quiescence_search(!side, depth-1, alpha, beta);
-            // Currently found a better move, then set it as best move
-            if(score > best_score){
-                best_score = score;
+        // Only legal moves are generated
+        make_move(pos, move, undo);
+        legal_moves++;
+
+        // Score of the other side, negated
+        int score;
+        if(legal_moves == 1){
+            score = -find_best_move(search, depth-1, ply+1, -beta, -alpha);
+        }
+        else{
+            // Reduce quiet moves after the killers & captures losing material, but not checks or check evasions
+            int reduction = 0;
+            if(lmr_full_depth_moves > 0 && legal_moves > lmr_full_depth_moves && depth >= 3 && !checked && possible_moves.get_score(i) < 17000000 && !in_check(pos, pos.side_to_move)){
+                reduction = min(lmr_reductions[min(depth, MAX_DEPTH)][min(legal_moves, MAX_MOVES - 1)], depth - 2);
             }
 
-            // Reset board to original state for next possible move evaluation
-            copy(&chess_board_copy[0][0], &chess_board_copy[0][0] + 8*16, &chess_board[0][0]);
-            castle = castle_copy;
-            enpassant = enpassant_copy;
-            side_to_move = side;
-            copy(&king_track_copy[0], &king_track_copy[0] + 2, &king_track[0]);
+            score = -find_best_move(search, depth-1-reduction, ply+1, -alpha-1, -alpha);
+            if(reduction > 0 && score > alpha) score = -find_best_move(search, depth-1, ply+1, -alpha-1, -alpha);
+            if(score > alpha && score < beta) score = -find_best_move(search, depth-1, ply+1, -beta, -alpha);
+        }
+
+        // Take the move back for next possible move evaluation
+        unmake_move(pos, move, undo);
+        if(search.stop->load(memory_order_relaxed)) return 0;
+
+        // Currently found a better move, then set it as best move
+        if(score > best_score){
+            best_score = score;
+            best_move = move;
         }
 
-        return best_score;
+        // Alpha Beta Pruning
+        if(best_score > alpha){
+            alpha = best_score;
+            update_pv(search, move, ply);
+        }
+        if(alpha >= beta){
+            search.cutoffs++;
+            if(legal_moves == 1) search.first_move_cutoffs++;
+            update_quiet_cutoff(search, move, depth, ply);
+            break;
+        }
     }
-    else{ // Black to move
-        int best_score = eval;
 
-        int count = possible_moves.get_count();
-        vector<int> moves = possible_moves.get_all_moves();
+    // Checkmate or stalemate
+    if(legal_moves == 0) return in_check(pos, side) ? -MATE_SCORE + ply : 0;
 
-        for(int i=0;i<count;i++){
-            // Check legal move & also sets the move if legal
-            if(!capture_flag(moves[i]) || !set_move(moves[i])){
-                copy(&chess_board_copy[0][0], &chess_board_copy[0][0] + 8*16, &chess_board[0][0]);
-                castle = castle_copy;
-                enpassant = enpassant_copy;
-                side_to_move = side;
-                copy(&king_track_copy[0], &king_track_copy[0] + 2, &king_track[0]);
-                continue;
+    search.options.table->store(pos.hash_key, best_move, tt_bound(best_score, alpha_original, beta), depth, score_to_tt(best_score, ply));
+    return best_score;
+}
+
+// Aspiration Windows
+// Root search with a narrow window around the previous iteration's score, most iterations stay inside it
+// and cut far more than a full window search, the window is widened on the failing side until the score fits
+#define ASPIRATION_WINDOW 50
+
+int aspiration_search(SearchContext &search, int depth, int previous_score){
+    if(depth < 4 || abs(previous_score) > MATE_BOUND) return find_best_move(search, depth, 0, -INF_SCORE, INF_SCORE);
+
+    int window = ASPIRATION_WINDOW;
+    int alpha = previous_score - window, beta = previous_score + window;
+    while(true){
+        int score = find_best_move(search, depth, 0, alpha, beta);
+        if(search.stop->load(memory_order_relaxed)) return 0;
+
+        window *= 2;
+        if(score <= alpha) alpha = max(score - window, -INF_SCORE);
+        else if(score >= beta) beta = min(score + window, INF_SCORE);
+        else return score;
+    }
+}
+
+// Options of the UCI & command line searches
+SearchOptions engine_options = {1, 2, 3, &transposition_table};
+
+// Search Limits, 0 -> not set
+struct SearchLimits{
+    int depth;
+    long long movetime;         // ms for this move
+    long long wtime, btime;     // ms left on the clocks
+    long long winc, binc;       // ms increment per move
+    int movestogo;              // moves until the next time control
+    long long nodes;
+    bool infinite;              // Only stop when told to
+};
+
+// Result of the last completed iteration
+struct SearchResult{
+    int best_move;
+    vector<int> pv;             // Principal variation, starts with best_move
+    int score;                  // For the side to move
+    int depth;
+    long long nodes;
+    long long time;             // ms
+
+    // Beta cutoffs of all threads & the ones caused by the first legal move
+    long long cutoffs;
+    long long first_move_cutoffs;
+
+    long long quiescence_nodes;
+};
+
+// Time for this move in ms from the limits, -1 if the search is not timed
+long long allocate_time(SearchLimits &limits, int side){
+    if(limits.infinite) return -1;
+    if(limits.movetime > 0) return limits.movetime;
+
+    long long time_left = side == white ? limits.wtime : limits.btime;
+    long long increment = side == white ? limits.winc : limits.binc;
+    if(time_left <= 0) return -1;
+
+    // Spread the clock over the moves to go (~30 if unknown), keeping a safety margin for move overhead
+    int moves_left = limits.movestogo > 0 ? min(limits.movestogo, 30) : 30;
+    return max(1LL, min(time_left - 50, time_left / moves_left + increment * 3 / 4));
+}
+
+// Lazy SMP
+// All threads search the same root on a private copy of the position and share the transposition table
+// Odd helper threads search one ply deeper so they fill the table with different entries
+// The main thread's result is used, helpers are stopped as soon as it finishes
+// Iterative Deepening
+// Every thread searches depth 1, 2, ... until a limit is hit, result is the last iteration the main thread completed
+// on_iteration is called by the main thread after each completed iteration
+// Setting stop from another thread ends the search, the last completed iteration is still returned
+int search_position(Position &pos, SearchLimits &limits, SearchOptions &options, SearchResult &result, atomic<bool> &stop, function<void(SearchResult &)> on_iteration = nullptr){
+    auto start_time = chrono::steady_clock::now();
+    int max_depth = limits.depth > 0 ? min(limits.depth, MAX_DEPTH) : MAX_DEPTH;
+    int threads = max(options.threads, 1);
+
+    // Every thread checks the limits, so helpers stop on time even while the main thread isn't running
+    vector<SearchContext> contexts(threads);
+    for(int i=0;i<threads;i++){
+        contexts[i].pos = pos;
+        contexts[i].options = options;
+        contexts[i].nodes = 0;
+        contexts[i].stop = &stop;
+        contexts[i].time_limit = allocate_time(limits, pos.side_to_move);
+        contexts[i].node_limit = limits.nodes > 0 ? limits.nodes : -1;
+        contexts[i].start_time = start_time;
+        contexts[i].next_check = 0;
+        contexts[i].threads = contexts.data();
+        contexts[i].thread_count = threads;
+        memset(contexts[i].killer_moves, 0, sizeof(contexts[i].killer_moves));
+        memset(contexts[i].history_moves, 0, sizeof(contexts[i].history_moves));
+        contexts[i].cutoffs = 0;
+        contexts[i].first_move_cutoffs = 0;
+        contexts[i].quiescence_nodes = 0;
+    }
+
+    vector<thread> helpers;
+    for(int i=1;i<threads;i++){
+        helpers.emplace_back([&contexts, i, max_depth](){
+            int score = 0;
+            for(int depth=1;depth<=max_depth && !contexts[i].stop->load();depth++){
+                score = aspiration_search(contexts[i], min(depth + (i & 1), MAX_DEPTH), score);
             }
+        });
+    }
 
-            // Find best move for the other side and thus the evaluation
-            int score = quiescence_search(!side, depth-1, alpha, beta);
-            // Currently found a better move, then set it as best move
-            if(score < best_score){
-                best_score = score;
+    // Fall back to the first legal move if stopped before depth 1 completes
+    result.best_move = -1;
+    result.score = 0;
+    result.depth = 0;
+    Moves possible_moves;
+    generate_moves(contexts[0].pos, possible_moves, false, true);
+    if(possible_moves.get_count()) result.best_move = possible_moves.get_move(0);
+    for(int depth=1;depth<=max_depth;depth++){
+        int score = aspiration_search(contexts[0], depth, result.score);
+        if(stop) break;
+
+        // No legal move at the root leaves the pv empty & best_move at -1 (bestmove 0000)
+        result.pv.assign(contexts[0].pv_table[0], contexts[0].pv_table[0] + contexts[0].pv_length[0]);
+        if(!result.pv.empty()) result.best_move = result.pv[0];
+        result.score = score;
+        result.depth = depth;
+        result.time = elapsed_ms(start_time);
+        result.nodes = 0;
+        for(int i=0;i<threads;i++) result.nodes += contexts[i].nodes.load(memory_order_relaxed);
+        if(on_iteration) on_iteration(result);
+
+        // Next iteration takes several times longer, don't start it if it can't finish
+        if(contexts[0].time_limit >= 0 && result.time * 2 >= contexts[0].time_limit) break;
+    }
+
+    // An infinite search keeps its result until told to stop
+    while(limits.infinite && !stop) this_thread::sleep_for(chrono::milliseconds(1));
+
+    stop = true;
+    for(int i=0;i<(int)helpers.size();i++) helpers[i].join();
+
+    result.time = elapsed_ms(start_time);
+    result.nodes = result.cutoffs = result.first_move_cutoffs = result.quiescence_nodes = 0;
+    for(int i=0;i<threads;i++){
+        result.nodes += contexts[i].nodes;
+        result.cutoffs += contexts[i].cutoffs;
+        result.first_move_cutoffs += contexts[i].first_move_cutoffs;
+        result.quiescence_nodes += contexts[i].quiescence_nodes;
+    }
+    return result.score;
+}
+
+// SMP benchmark, time to depth & nodes/sec of test_position from 1 to max_threads threads
+void smp_benchmark(string &fen, int depth, int max_threads){
+    SearchOptions options = engine_options;
+    for(options.threads=1;options.threads<=max_threads;options.threads++){
+        Position position;
+        parse_fen_string_to_board(position, fen);
+        transposition_table.clear();
+
+        SearchLimits limits = {};
+        limits.depth = depth;
+        SearchResult result;
+        atomic<bool> stop(false);
+        auto start = chrono::steady_clock::now();
+        int score = search_position(position, limits, options, result, stop);
+        double seconds = chrono::duration<double>(chrono::steady_clock::now() - start).count();
+
+        cout << "Threads " << options.threads << ": depth " << depth << " in " << seconds << "s, " << result.nodes << " nodes, " << (long long)(result.nodes / seconds) << " nodes/sec, score " << score << ", best move ";
+        print_decoded_move(result.best_move);
+        cout << endl;
+    }
+}
+
+// Search benchmark, nodes & time of a fixed depth search over a suite of positions
+// Each position starts with an empty hash table, so node counts only change when the search does
+vector<string> benchmark_positions = {
+    "rnbqkbnr/pppppppp/8/8/8/8/PPPPPPPP/RNBQKBNR w KQkq - 0 1",
+    "r3k2r/p1ppqpb1/bn2pnp1/3PN3/1p2P3/2N2Q1p/PPPBBPPP/R3K2R w KQkq - 0 1",
+    "8/2p5/3p4/KP5r/1R3p1k/8/4P1P1/8 w - - 0 1",
+    "r3k2r/Pppp1ppp/1b3nbN/nP6/BBP1P3/q4N2/Pp1P2PP/R2Q1RK1 w kq - 0 1",
+    "rnbq1k1r/pp1Pbppp/2p5/8/2B5/8/PPP1NnPP/RNBQK2R w KQ - 1 8",
+    "r4rk1/1pp1qppp/p1np1n2/2b1p1B1/2B1P1b1/P1NP1N2/1PP1QPPP/R4RK1 w - - 0 10",
+    "r2qk2r/pp1b1pp1/2nppn1p/3p4/3P4/2NBPN2/PPPQ1PPP/R3K2R w KQkq - 0 9",
+    "6k1/5ppp/8/8/8/8/5PPP/3R2K1 w - - 0 1"
+};
+
+void search_benchmark(int depth){
+    long long total_nodes = 0;
+    double total_seconds = 0;
+    for(int i=0;i<(int)benchmark_positions.size();i++){
+        Position position;
+        parse_fen_string_to_board(position, benchmark_positions[i]);
+        transposition_table.clear();
+
+        SearchLimits limits = {};
+        limits.depth = depth;
+        SearchResult result;
+        atomic<bool> stop(false);
+        auto start = chrono::steady_clock::now();
+        int score = search_position(position, limits, engine_options, result, stop);
+        double seconds = chrono::duration<double>(chrono::steady_clock::now() - start).count();
+        total_nodes += result.nodes;
+        total_seconds += seconds;
+
+        cout << "Position " << i+1 << ": " << result.nodes << " nodes, score " << score << ", best move ";
+        print_decoded_move(result.best_move);
+        cout << endl;
+    }
+    cout << "\nTotal: " << total_nodes << " nodes in " << total_seconds << "s, " << (long long)(total_nodes / total_seconds) << " nodes/sec" << endl;
+}
+
+// Perft Hash Table
+// Node counts of subtrees already counted, keyed by Zobrist key & remaining depth, shared by all perft threads
+// Same lockless scheme as the transposition table, entries store (hash key ^ data) and data
+// data -> nodes (56 bits) | depth (8 bits), 0 MB -> disabled
+class PerftTable{
+    private:
+        TTEntry *entries;
+        U64 entry_count;
+    public:
+        PerftTable(){
+            entries = nullptr;
+            entry_count = 0;
+        }
+        ~PerftTable(){
+            delete[] entries;
+        }
+        // Allocate the largest power of two number of entries fitting in size_mb
+        void resize(int size_mb){
+            delete[] entries;
+            entries = nullptr;
+            entry_count = 0;
+            if(size_mb <= 0) return;
+
+            U64 count = 1;
+            while(count * 2 * sizeof(TTEntry) <= (U64)size_mb * 1024 * 1024) count *= 2;
+            entries = new TTEntry[count];
+            entry_count = count;
+            for(U64 i=0;i<entry_count;i++){
+                entries[i].key.store(0, memory_order_relaxed);
+                entries[i].data.store(0, memory_order_relaxed);
             }
+        }
+        bool probe(U64 key, int depth, long long &nodes){
+            if(!entry_count) return false;
+            TTEntry &entry = entries[key & (entry_count - 1)];
+            U64 data = entry.data.load(memory_order_relaxed);
+            if(!data || (int)(data & 0xFF) != depth || (entry.key.load(memory_order_relaxed) ^ data) != key) return false;
+            nodes = data >> 8;
+            return true;
+        }
+        // Always replace
+        void store(U64 key, int depth, long long nodes){
+            if(!entry_count) return;
+            TTEntry &entry = entries[key & (entry_count - 1)];
+            U64 data = ((U64)nodes << 8) | depth;
+            entry.data.store(data, memory_order_relaxed);
+            entry.key.store(key ^ data, memory_order_relaxed);
+        }
+}perft_table;
+
+// Performance Test by checking number of valid generated moves
+// Bulk counting, the legal moves at depth 1 are counted without playing them
+long long performance_test(Position &pos, int depth){
+    if(depth == 0) return 1;
+
+    long long nodes = 0;
+    if(depth > 1 && perft_table.probe(pos.hash_key, depth, nodes)) return nodes;
+
+    Moves possible_moves;
+    generate_moves(pos, possible_moves, false, true);
+
+    int count = possible_moves.get_count();
+    if(depth == 1) return count;
+
+    Undo undo;
+
+    for(int i=0;i<count;i++){
+        int move = possible_moves.get_move(i);
+        make_move(pos, move, undo);
+        nodes += performance_test(pos, depth-1);
+        unmake_move(pos, move, undo);
+    }
+
+    perft_table.store(pos.hash_key, depth, nodes);
+    return nodes;
+}
+
+// Parallel Perft
+// Legal root moves are handed out to the threads one at a time through a shared counter,
+// each thread counts below its moves on a private copy of the position
+// Node counts below each root move end up in root_moves & counts, in generation order
+long long parallel_perft(Position &pos, int depth, int threads, vector<int> &root_moves, vector<long long> &counts){
+    Moves possible_moves;
+    generate_moves(pos, possible_moves, false, true);
+    root_moves.clear();
+    for(int i=0;i<possible_moves.get_count();i++) root_moves.push_back(possible_moves.get_move(i));
+    counts.assign(root_moves.size(), 0);
+
+    atomic<int> next_move(0);
+    auto count_moves = [&](){
+        Position position = pos;
+        Undo undo;
+        for(int i=next_move++;i<(int)root_moves.size();i=next_move++){
+            make_move(position, root_moves[i], undo);
+            counts[i] = performance_test(position, depth-1);
+            unmake_move(position, root_moves[i], undo);
+        }
+    };
+    vector<thread> helpers;
+    for(int i=1;i<threads;i++) helpers.emplace_back(count_moves);
+    count_moves();
+    for(int i=0;i<(int)helpers.size();i++) helpers[i].join();
+
+    long long total = 0;
+    for(int i=0;i<(int)counts.size();i++) total += counts[i];
+    return total;
+}
+
+string move_to_uci(int move);
+
+// Divide Perft, node count below each root move & the total, for finding move generation bugs against another engine
+void perft_divide(string &fen, int depth){
+    Position position;
+    parse_fen_string_to_board(position, fen);
+
+    vector<int> root_moves;
+    vector<long long> counts;
+    auto start = chrono::steady_clock::now();
+    long long total = parallel_perft(position, max(depth, 1), engine_options.threads, root_moves, counts);
+    double seconds = chrono::duration<double>(chrono::steady_clock::now() - start).count();
+
+    for(int i=0;i<(int)root_moves.size();i++) cout << move_to_uci(root_moves[i]) << ": " << counts[i] << endl;
+    cout << "\nNodes: " << total << " in " << seconds << "s, " << (long long)(total / seconds) << " nodes/sec (" << engine_options.threads << " threads)" << endl;
+}
+
+// Perft Suite, known node counts of the standard perft positions, as regression test & speed benchmark
+struct PerftCase{
+    string fen;
+    int depth;
+    long long nodes;
+};
+
+vector<PerftCase> perft_suite = {
+    {"rnbqkbnr/pppppppp/8/8/8/8/PPPPPPPP/RNBQKBNR w KQkq - 0 1", 5, 4865609},
+    {"r3k2r/p1ppqpb1/bn2pnp1/3PN3/1p2P3/2N2Q1p/PPPBBPPP/R3K2R w KQkq - 0 1", 4, 4085603},
+    {"8/2p5/3p4/KP5r/1R3p1k/8/4P1P1/8 w - - 0 1", 6, 11030083},
+    {"r3k2r/Pppp1ppp/1b3nbN/nP6/BBP1P3/q4N2/Pp1P2PP/R2Q1RK1 w kq - 0 1", 5, 15833292},
+    {"rnbq1k1r/pp1Pbppp/2p5/8/2B5/8/PPP1NnPP/RNBQK2R w KQ - 1 8", 4, 2103487},
+    {"r4rk1/1pp1qppp/p1np1n2/2b1p1B1/2B1P1b1/P1NP1N2/1PP1QPPP/R4RK1 w - - 0 10", 4, 3894594}
+};
+
+// Returns false if any count is wrong
+bool perft_suite_test(){
+    bool passed = true;
+    long long total_nodes = 0;
+    double total_seconds = 0;
+    for(int i=0;i<(int)perft_suite.size();i++){
+        Position position;
+        parse_fen_string_to_board(position, perft_suite[i].fen);
+
+        vector<int> root_moves;
+        vector<long long> counts;
+        auto start = chrono::steady_clock::now();
+        long long nodes = parallel_perft(position, perft_suite[i].depth, engine_options.threads, root_moves, counts);
+        double seconds = chrono::duration<double>(chrono::steady_clock::now() - start).count();
+        total_nodes += nodes;
+        total_seconds += seconds;
+
+        bool correct = nodes == perft_suite[i].nodes;
+        passed = passed && correct;
+        cout << "Position " << i+1 << ": depth " << perft_suite[i].depth << ", " << nodes << " nodes " << (correct ? "OK" : "FAILED, expected " + to_string(perft_suite[i].nodes)) << ", " << seconds << "s" << endl;
+    }
+    cout << "\nTotal: " << total_nodes << " nodes in " << total_seconds << "s, " << (long long)(total_nodes / total_seconds) << " nodes/sec (" << engine_options.threads << " threads)" << endl;
+    return passed;
+}
 
-            // Reset board to original state for next possible move evaluation
-            copy(&chess_board_copy[0][0], &chess_board_copy[0][0] + 8*16, &chess_board[0][0]);
-            castle = castle_copy;
-            enpassant = enpassant_copy;
-            side_to_move = side;
-            copy(&king_track_copy[0], &king_track_copy[0] + 2, &king_track[0]);
+// Static Exchange Evaluation Suite
+// Exchanges with known values, covering x-rays, en passant, promotions & the king as last attacker
+struct SeeCase{
+    string fen;
+    string move;
+    int value;
+};
+
+vector<SeeCase> see_suite = {
+    {"1k1r4/1pp4p/p7/4p3/8/P5P1/1PP4P/2K1R3 w - - 0 1", "e1e5", 100},
+    {"1k1r3q/1ppn3p/p4b2/4p3/8/P2N2P1/1PP1R1BP/2K1Q3 w - - 0 1", "d3e5", -225},
+    {"4k3/8/8/3p4/4P3/8/8/4K3 w - - 0 1", "e4d5", 100},
+    {"4k3/8/2p5/3p4/8/8/3R4/4K3 w - - 0 1", "d2d5", -400},
+    {"4k3/3r4/8/3p4/8/8/3R4/3RK3 w - - 0 1", "d2d5", 100},
+    {"4k3/8/8/3pP3/8/8/8/4K3 w - d6 0 1", "e5d6", 100},
+    {"8/8/8/3p4/4k3/8/8/3RK3 w - - 0 1", "d1d5", -400},
+    {"8/8/8/3p4/4k3/8/B7/3RK3 w - - 0 1", "d1d5", 100},
+    {"3r3k/2P5/8/8/8/8/8/4K3 w - - 0 1", "c7d8q", 1300},
+    {"4k3/8/8/3q4/8/8/8/3QK3 b - - 0 1", "d5d1", 0},
+    {"4k3/8/8/3q4/8/8/3P4/3RK3 b - - 0 1", "d5d2", -800}
+};
+
+// Returns false if any value is wrong
+bool see_suite_test(){
+    bool passed = true;
+    for(int i=0;i<(int)see_suite.size();i++){
+        Position position;
+        parse_fen_string_to_board(position, see_suite[i].fen);
+
+        Moves possible_moves;
+        generate_moves(position, possible_moves, false, true);
+        int move = 0;
+        for(int j=0;j<possible_moves.get_count();j++){
+            if(move_to_uci(possible_moves.get_move(j)) == see_suite[i].move) move = possible_moves.get_move(j);
         }
 
-        return best_score;
+        bool correct = move && see(position, move) == see_suite[i].value;
+        passed = passed && correct;
+        cout << "Position " << i+1 << ": " << see_suite[i].move << " " << (move ? to_string(see(position, move)) : "illegal") << " " << (correct ? "OK" : "FAILED, expected " + to_string(see_suite[i].value)) << endl;
     }
+    return passed;
 }
 
+// Perft benchmark comparing ray walking slider attacks with magic bitboard lookups
+void perft_benchmark(string &fen, int depth){
+    for(int magic=0;magic<2;magic++){
+        use_magic_attacks = magic;
 
-// Best final Move stored globally
-int final_best_move = -1;
-// Recursion Logic to find best move
-int find_best_move(int side, int depth, int alpha, int beta){
-    // if(depth == 0) return quiescence_search(side, 3, alpha, beta);
-    if(depth == 0) return evaluate_position();
+        Position position;
+        parse_fen_string_to_board(position, fen);
+
+        auto start = chrono::steady_clock::now();
+        long long nodes = performance_test(position, depth);
+        double seconds = chrono::duration<double>(chrono::steady_clock::now() - start).count();
+
+#ifdef USE_PEXT
+        cout << (magic ? "PEXT attacks:        " : "Ray walking attacks: ");
+#else
+        cout << (magic ? "Magic attacks:       " : "Ray walking attacks: ");
+#endif
+        cout << nodes << " nodes in " << seconds << "s, " << (long long)(nodes / seconds) << " nodes/sec" << endl;
+    }
+    use_magic_attacks = true;
+}
+
+// UCI Protocol
+// Move in coordinate notation, e.g. e2e4, e7e8q
+string move_to_uci(int move){
+    if(move <= 0) return "0000";
+    string uci = index_to_position[source_square(move)/16][source_square(move)%16] + index_to_position[target_square(move)/16][target_square(move)%16];
+    if(promoted_piece(move)) uci += ascii_pieces[promoted_piece(move) >= p ? promoted_piece(move) : promoted_piece(move) + 6];
+    return uci;
+}
 
+// Legal move of the position matching coordinate notation, 0 if there is none
+int parse_uci_move(Position &pos, string uci){
     Moves possible_moves;
-    generate_moves(side, possible_moves);
-
-    // Keep an original board copy
-    int chess_board_copy[8][16];
-    copy(&chess_board[0][0], &chess_board[0][0] + 8*16, &chess_board_copy[0][0]);
-    int castle_copy = castle;
-    int enpassant_copy = enpassant;
-    side_to_move = side;
-    int king_track_copy[2];
-    copy(&king_track[0], &king_track[0] + 2, &king_track_copy[0]);
-
-    if(!side){ // White to move
-        int best_score = INT_MIN;
-        int best_move = -1;
-        int legal_moves = 0;
-
-        int count = possible_moves.get_count();
-        vector<int> moves = possible_moves.get_all_moves();
-
-        for(int i=0;i<count;i++){
-            // Check legal move & also sets the move if legal
-            if(!set_move(moves[i])){
-                copy(&chess_board_copy[0][0], &chess_board_copy[0][0] + 8*16, &chess_board[0][0]);
-                castle = castle_copy;
-                enpassant = enpassant_copy;
-                side_to_move = side;
-                copy(&king_track_copy[0], &king_track_copy[0] + 2, &king_track[0]);
-                continue;
-            }
-            legal_moves++;
-
-            // Find best move for the other side and thus the evaluation
-            int score = find_best_move(!side, depth-1, alpha, beta);
-            // Currently found a better move, then set it as best move
-            if(score > best_score){
-                best_score = score;
-                best_move = moves[i];
-            }
+    generate_moves(pos, possible_moves, false, true);
+    for(int i=0;i<possible_moves.get_count();i++){
+        if(move_to_uci(possible_moves.get_move(i)) == uci) return possible_moves.get_move(i);
+    }
+    return 0;
+}
 
-            // Alpha Beta Pruning
-            alpha = max(alpha, best_score);
-            if(alpha >= beta){
-                // Reset board to original state for next possible move evaluation
-                copy(&chess_board_copy[0][0], &chess_board_copy[0][0] + 8*16, &chess_board[0][0]);
-                castle = castle_copy;
-                enpassant = enpassant_copy;
-                side_to_move = side;
-                copy(&king_track_copy[0], &king_track_copy[0] + 2, &king_track[0]);
-                break;
-            }
+// Score for the side to move, as cp or as moves to mate
+// Mate scores are MATE_SCORE - ply of the mated node, so the mate is MATE_SCORE - |score| plies away
+string score_to_uci(int score){
+    if(abs(score) > MATE_BOUND){
+        int plies = MATE_SCORE - abs(score);
+        return "mate " + to_string(score > 0 ? (plies + 1) / 2 : -(plies / 2));
+    }
+    return "cp " + to_string(score);
+}
+
+// Search thread & main thread both write to stdout
+mutex output_mutex;
+void uci_send(string message){
+    lock_guard<mutex> lock(output_mutex);
+    cout << message << endl;
+}
+
+// position [startpos | fen <fen>] [moves <move> ...]
+void uci_position(Position &pos, istringstream &input){
+    string token, fen;
+    input >> token;
+    if(token == "startpos"){
+        fen = starting_position;
+        input >> token;
+    }
+    else if(token == "fen"){
+        while(input >> token && token != "moves") fen += token + " ";
+    }
+    else return;
 
-            // Reset board to original state for next possible move evaluation
-            copy(&chess_board_copy[0][0], &chess_board_copy[0][0] + 8*16, &chess_board[0][0]);
-            castle = castle_copy;
-            enpassant = enpassant_copy;
-            side_to_move = side;
-            copy(&king_track_copy[0], &king_track_copy[0] + 2, &king_track[0]);
+    // A rejected FEN leaves the position as it was
+    Position position;
+    fen_errors error = parse_fen_string_to_board(position, fen);
+    if(error != fen_ok){
+        uci_send("info string Invalid FEN: " + fen_error_message[error]);
+        return;
+    }
+
+    // Play the moves, stopping at the first illegal one
+    if(token == "moves"){
+        Undo undo;
+        while(input >> token){
+            int move = parse_uci_move(position, token);
+            if(!move) break;
+            make_move(position, move, undo);
+            trim_key_history(position);
         }
+    }
+    pos = position;
+}
 
-        if(legal_moves == 0){
-            if(is_square_attacked(king_track[0]/16,king_track[0]%16,!side)){
-                return -100000 - depth; // Doing it to find quickest mate, else something weird happens and it sometimes find mate in more moves
-            }
-            else{
-                return 0;
-            }
+// go [depth N] [movetime MS] [nodes N] [wtime MS] [btime MS] [winc MS] [binc MS] [movestogo N] [infinite]
+SearchLimits uci_go_limits(istringstream &input){
+    SearchLimits limits = {};
+    string token;
+    while(input >> token){
+        if(token == "depth") input >> limits.depth;
+        else if(token == "movetime") input >> limits.movetime;
+        else if(token == "nodes") input >> limits.nodes;
+        else if(token == "wtime") input >> limits.wtime;
+        else if(token == "btime") input >> limits.btime;
+        else if(token == "winc") input >> limits.winc;
+        else if(token == "binc") input >> limits.binc;
+        else if(token == "movestogo") input >> limits.movestogo;
+        else if(token == "infinite") limits.infinite = true;
+    }
+    return limits;
+}
+
+// Read commands from stdin until quit, searches run on a background thread so stop is answered right away
+void uci_loop(){
+    Position position;
+    parse_fen_string_to_board(position, starting_position);
+
+    atomic<bool> stop(false);
+    thread search_thread;
+    auto stop_search = [&](){
+        stop = true;
+        if(search_thread.joinable()) search_thread.join();
+    };
+
+    string line, command;
+    while(getline(cin, line)){
+        istringstream input(line);
+        if(!(input >> command)) continue;
+
+        if(command == "uci"){
+            uci_send("id name Chess-Engine");
+            uci_send("id author Aayush5sep");
+            uci_send("option name Hash type spin default 16 min 1 max 65536");
+            uci_send("option name Threads type spin default 1 min 1 max 256");
+            uci_send("option name NullMoveReduction type spin default 2 min 0 max 4");
+            uci_send("option name LMRFullDepthMoves type spin default 3 min 0 max 64");
+            uci_send("uciok");
+        }
+        else if(command == "isready"){
+            uci_send("readyok");
         }
+        else if(command == "setoption"){
+            // setoption name <name> value <value>
+            string token, name, value;
+            input >> token >> name >> token >> value;
+            stop_search();
+            if(name == "Hash") transposition_table.resize(atoi(value.c_str()));
+            else if(name == "Threads") engine_options.threads = max(1, atoi(value.c_str()));
+            else if(name == "NullMoveReduction") engine_options.null_move_reduction = max(0, atoi(value.c_str()));
+            else if(name == "LMRFullDepthMoves") engine_options.lmr_full_depth_moves = max(0, atoi(value.c_str()));
+        }
+        else if(command == "ucinewgame"){
+            stop_search();
+            transposition_table.clear();
+        }
+        else if(command == "position"){
+            stop_search();
+            uci_position(position, input);
+        }
+        else if(command == "go"){
+            stop_search();
+            stop = false;
+            SearchLimits limits = uci_go_limits(input);
+            search_thread = thread([position, limits, &stop]() mutable {
+                SearchResult result;
+                search_position(position, limits, engine_options, result, stop, [](SearchResult &iteration){
+                    long long nps = iteration.nodes * 1000 / max(iteration.time, 1LL);
+                    string pv;
+                    for(int move : iteration.pv) pv += " " + move_to_uci(move);
+                    uci_send("info depth " + to_string(iteration.depth) + " score " + score_to_uci(iteration.score) + " nodes " + to_string(iteration.nodes) + " nps " + to_string(nps) + " time " + to_string(iteration.time) + " pv" + pv);
+                });
+                if(result.cutoffs) uci_send("info string first move cutoffs " + to_string(100 * result.first_move_cutoffs / result.cutoffs) + "%");
+                uci_send("bestmove " + move_to_uci(result.best_move));
+            });
+        }
+        else if(command == "stop"){
+            stop_search();
+        }
+        else if(command == "quit"){
+            break;
+        }
+        else if(command == "d"){
+            lock_guard<mutex> lock(output_mutex);
+            print_chess_board(position);
+        }
+    }
+    stop_search();
+}
+
+// Library API, see chess.h
+// An engine is its own position, transposition table & search options, calls on it are serialized by its lock
+// stop is only written by the searching thread when it starts & by chess_engine_cancel, so cancelling never waits
+struct chess_engine{
+    Position position;
+    TranspositionTable table;
+    SearchOptions options;
+    mutex lock;
+
+    // Cancelling, guarded by cancel_lock
+    // A cancel stops the running search & every search call made before it returns, cancelled is only reset when
+    // the last of them (searches counts the calls running or waiting for lock) returns, so a cancel arriving before
+    // its search has started isn't lost
+    mutex cancel_lock;
+    int searches;
+    bool cancelled;
+    atomic<bool> *running_stop;     // Stop flag of the running search, nullptr if none
+
+    chess_engine(int hash_mb) : table(hash_mb), searches(0), cancelled(false), running_stop(nullptr){}
+};
+
+once_flag library_initialized;
+
+void init_library(){
+    call_once(library_initialized, [](){
+        init_attack_tables();
+        init_hash_keys();
+        init_evaluation_tables();
+        init_search_tables();
+    });
+}
+
+void fill_info(SearchResult &result, chess_info &info){
+    info.depth = result.depth;
+    info.score = result.score;
+    info.mate = 0;
+    if(abs(result.score) > MATE_BOUND){
+        int plies = MATE_SCORE - abs(result.score);
+        info.mate = result.score > 0 ? (plies + 1) / 2 : -(plies / 2);
+    }
+    info.nodes = result.nodes;
+    info.time = result.time;
+    snprintf(info.best_move, sizeof(info.best_move), "%s", move_to_uci(result.best_move).c_str());
+
+    string pv;
+    for(int move : result.pv) pv += (pv.empty() ? "" : " ") + move_to_uci(move);
+    snprintf(info.pv, sizeof(info.pv), "%s", pv.c_str());
+}
 
-        final_best_move = best_move;
-        return best_score;
+extern "C" chess_engine *chess_engine_create(int hash_mb, int threads){
+    init_library();
+    chess_engine *engine;
+    try{
+        engine = new chess_engine(max(hash_mb, 1));
+    }
+    catch(bad_alloc &){
+        return nullptr;
     }
-    else{ // Black to move
-        int best_score = INT_MAX;
-        int best_move = -1;
-        int legal_moves = 0;
 
-        int count = possible_moves.get_count();
-        vector<int> moves = possible_moves.get_all_moves();
+    engine->options = engine_options;
+    engine->options.threads = max(threads, 1);
+    engine->options.table = &engine->table;
+    parse_fen_string_to_board(engine->position, starting_position);
+    return engine;
+}
+
+extern "C" int chess_engine_set_fen(chess_engine *engine, const char *fen){
+    Position position;
+    if(!fen || parse_fen_string_to_board(position, fen) != fen_ok) return -1;
+
+    lock_guard<mutex> guard(engine->lock);
+    engine->position = position;
+    return 0;
+}
+
+// Search of chess_engine_search once it holds the engine lock
+int run_engine_search(chess_engine *engine, const chess_limits *limits, chess_callback on_iteration, void *user_data, chess_info *result, atomic<bool> &stop){
+    Moves possible_moves;
+    generate_moves(engine->position, possible_moves, false, true);
+    if(!possible_moves.get_count()) return -1;
+
+    SearchLimits search_limits = {};
+    if(limits){
+        search_limits.depth = limits->depth;
+        search_limits.movetime = limits->movetime;
+        search_limits.wtime = limits->wtime;
+        search_limits.btime = limits->btime;
+        search_limits.winc = limits->winc;
+        search_limits.binc = limits->binc;
+        search_limits.movestogo = limits->movestogo;
+        search_limits.nodes = limits->nodes;
+    }
+
+    SearchResult search_result;
+    search_position(engine->position, search_limits, engine->options, search_result, stop, [on_iteration, user_data](SearchResult &iteration){
+        if(!on_iteration) return;
+        chess_info info;
+        fill_info(iteration, info);
+        on_iteration(&info, user_data);
+    });
+    if(result) fill_info(search_result, *result);
+    return 0;
+}
+
+extern "C" int chess_engine_search(chess_engine *engine, const chess_limits *limits, chess_callback on_iteration, void *user_data, chess_info *result){
+    {
+        lock_guard<mutex> cancel_guard(engine->cancel_lock);
+        engine->searches++;
+    }
+    lock_guard<mutex> guard(engine->lock);
+
+    // Each search has its own stop flag, set right away if a cancel came in while waiting
+    atomic<bool> stop(false);
+    {
+        lock_guard<mutex> cancel_guard(engine->cancel_lock);
+        stop = engine->cancelled;
+        engine->running_stop = &stop;
+    }
+    int status = run_engine_search(engine, limits, on_iteration, user_data, result, stop);
+    {
+        lock_guard<mutex> cancel_guard(engine->cancel_lock);
+        engine->running_stop = nullptr;
+        if(--engine->searches == 0) engine->cancelled = false;
+    }
+    return status;
+}
+
+extern "C" void chess_engine_cancel(chess_engine *engine){
+    lock_guard<mutex> cancel_guard(engine->cancel_lock);
+    engine->cancelled = true;
+    if(engine->running_stop) *engine->running_stop = true;
+}
+
+extern "C" void chess_engine_destroy(chess_engine *engine){
+    if(!engine) return;
+    chess_engine_cancel(engine);
+    {
+        // Wait for a running search to return
+        lock_guard<mutex> guard(engine->lock);
+    }
+    delete engine;
+}
+
+// Batch Analysis
+// Searches every FEN / EPD line of a stream with the startup limits & writes one result line per position, in input order
+//     <line number> bestmove <move> score <cp N | mate N> depth <N> nodes <N> time <ms> [id "<EPD id>"]
+//     <line number> error <reason the FEN is rejected, see fen_error_message>
+// Each worker thread searches one position at a time, single threaded with its own transposition table (not cleared
+// between positions). Lines are dealt round-robin to per-worker queues, a worker with an empty queue steals the oldest
+// line of another, so a worker stuck on a slow position doesn't hold up the rest of its queue.
+// At most batch_window lines are read ahead of the output, so memory stays constant for any input size.
+struct BatchJob{
+    long long index;        // Position number, decides the output slot
+    long long line_number;
+    string line;
+};
+
+struct BatchQueue{
+    mutex lock;
+    deque<BatchJob> jobs;
+};
+
+// Result line of one position
+string analyze_batch_line(string &line, long long line_number, SearchLimits limits, SearchOptions &options){
+    Position position;
+    size_t fen_length;
+    fen_errors error = parse_fen_string_to_board(position, line, &fen_length);
+    if(error != fen_ok) return to_string(line_number) + " error " + fen_error_message[error];
+
+    // EPD operations after the position, only the id is kept
+    istringstream input(line.substr(fen_length));
+    string token, id;
+    while(input >> token){
+        if(token == "id"){
+            // Operand up to the ;, an empty one (id;) means no id
+            getline(input, id, ';');
+            size_t first = id.find_first_not_of(" \t\r"), last = id.find_last_not_of(" \t\r");
+            id = first == string::npos ? "" : id.substr(first, last - first + 1);
+        }
+    }
+
+
+    // No legal move, checkmate or stalemate
+    Moves possible_moves;
+    generate_moves(position, possible_moves, false, true);
+    if(!possible_moves.get_count()){
+        string output = to_string(line_number) + " bestmove 0000 score " + (in_check(position, position.side_to_move) ? "mate 0" : "cp 0") + " depth 0 nodes 0 time 0";
+        return id.empty() ? output : output + " id " + id;
+    }
+
+    SearchResult result;
+    atomic<bool> stop(false);
+    search_position(position, limits, options, result, stop);
+
+    string output = to_string(line_number) + " bestmove " + move_to_uci(result.best_move) + " score " + score_to_uci(result.score) + " depth " + to_string(result.depth) + " nodes " + to_string(result.nodes) + " time " + to_string(result.time);
+    if(!id.empty()) output += " id " + id;
+    return output;
+}
 
-        for(int i=0;i<count;i++){
-            // Check legal move & also sets the move if legal
-            if(!set_move(moves[i])){
-                copy(&chess_board_copy[0][0], &chess_board_copy[0][0] + 8*16, &chess_board[0][0]);
-                castle = castle_copy;
-                enpassant = enpassant_copy;
-                side_to_move = side;
-                copy(&king_track_copy[0], &king_track_copy[0] + 2, &king_track[0]);
+void batch_analysis(istream &input, ostream &output, SearchLimits &limits, int workers, int hash_mb){
+    workers = max(workers, 1);
+    long long batch_window = 64LL * workers;
+
+    vector<BatchQueue> queues(workers);
+    vector<string> results(batch_window);
+    vector<bool> ready(batch_window, false);
+    long long read_count = 0, written_count = 0;
+    bool input_done = false;
+
+    // lock guards the counters, results & ready, work is signalled when a job is queued or the input ends,
+    // space when a result is written
+    mutex lock;
+    condition_variable work, space;
+
+    auto take_job = [&](int worker, BatchJob &job){
+        for(int i=0;i<workers;i++){
+            BatchQueue &queue = queues[(worker + i) % workers];
+            lock_guard<mutex> guard(queue.lock);
+            if(queue.jobs.empty()) continue;
+            job = queue.jobs.front();
+            queue.jobs.pop_front();
+            return true;
+        }
+        return false;
+    };
+
+    auto run_worker = [&](int worker){
+        TranspositionTable table(hash_mb);
+        SearchOptions options = engine_options;
+        options.threads = 1;
+        options.table = &table;
+
+        while(true){
+            BatchJob job;
+            if(!take_job(worker, job)){
+                unique_lock<mutex> guard(lock);
+                if(input_done && written_count == read_count) return;
+                work.wait_for(guard, chrono::milliseconds(10));
                 continue;
             }
-            legal_moves++;
-
-            // Find best move for the other side and thus the evaluation
-            int score = find_best_move(!side, depth-1, alpha, beta);
-            // Currently found a better move, then set it as best move
-            if(score < best_score){
-                best_score = score;
-                best_move = moves[i];
-            }
 
-            // Alpha Beta Pruning
-            beta = min(beta, best_score);
-            if(alpha >= beta){
-                // Reset board to original state for next possible move evaluation
-                copy(&chess_board_copy[0][0], &chess_board_copy[0][0] + 8*16, &chess_board[0][0]);
-                castle = castle_copy;
-                enpassant = enpassant_copy;
-                side_to_move = side;
-                copy(&king_track_copy[0], &king_track_copy[0] + 2, &king_track[0]);
-                break;
+            string result = analyze_batch_line(job.line, job.line_number, limits, options);
+
+            // Write every finished result that is next in input order
+            lock_guard<mutex> guard(lock);
+            results[job.index % batch_window] = result;
+            ready[job.index % batch_window] = true;
+            while(ready[written_count % batch_window]){
+                output << results[written_count % batch_window] << '\n';
+                ready[written_count % batch_window] = false;
+                written_count++;
             }
+            output.flush();
+            space.notify_one();
+            if(input_done && written_count == read_count) work.notify_all();
+        }
+    };
+
+    vector<thread> threads;
+    for(int i=0;i<workers;i++) threads.emplace_back(run_worker, i);
+
+    string line;
+    long long line_number = 0;
+    while(getline(input, line)){
+        line_number++;
+        if(line.find_first_not_of(" \t\r") == string::npos || line[0] == '#') continue;
+
+        unique_lock<mutex> guard(lock);
+        space.wait(guard, [&](){ return read_count - written_count < batch_window; });
+        BatchJob job = {read_count, line_number, line};
+        {
+            lock_guard<mutex> queue_guard(queues[read_count % workers].lock);
+            queues[read_count % workers].jobs.push_back(job);
+        }
+        read_count++;
+        work.notify_one();
+    }
+    {
+        lock_guard<mutex> guard(lock);
+        input_done = true;
+    }
+    work.notify_all();
+    for(int i=0;i<workers;i++) threads[i].join();
+}
 
-            // Reset board to original state for next possible move evaluation
-            copy(&chess_board_copy[0][0], &chess_board_copy[0][0] + 8*16, &chess_board[0][0]);
-            castle = castle_copy;
-            enpassant = enpassant_copy;
-            side_to_move = side;
-            copy(&king_track_copy[0], &king_track_copy[0] + 2, &king_track[0]);
+// Self-Play
+// Plays games of the engine against itself on a pool of threads & writes them as PGN
+// Each worker plays one game at a time, both sides have their own single threaded engine with a -hash MB table,
+// cleared before every game. Games start from the openings in turn and are written as soon as they finish.
+// A game ends on mate, stalemate, the fifty-move rule, threefold repetition, insufficient material or a flag fall
+
+// Move in standard algebraic notation, e.g. Nbd2, exd5, e8=Q+, O-O, the move has to be legal in the position
+string move_to_san(Position &pos, int move){
+    int source = index_64(source_square(move)), target = index_64(target_square(move));
+    int piece = pos.board[source], type = piece >= p ? piece - 6 : piece;
+    string san;
+
+    if(castling_flag(move)) san = target % 8 == 6 ? "O-O" : "O-O-O";
+    else if(type == P){
+        if(capture_flag(move)) san = string(1, 'a' + source % 8) + "x";
+        san += index_to_position[target/8][target%8];
+        if(promoted_piece(move)) san += string("=") + ascii_pieces[promoted_piece(move) >= p ? promoted_piece(move) - 6 : promoted_piece(move)];
+    }
+    else{
+        san = ascii_pieces[type];
+
+        // Name the source file, else rank, else square if another piece of the same kind can move to the target
+        Moves possible_moves;
+        generate_moves(pos, possible_moves, false, true);
+        bool ambiguous = false, same_file = false, same_rank = false;
+        for(int i=0;i<possible_moves.get_count();i++){
+            int other = index_64(source_square(possible_moves.get_move(i)));
+            if(other == source || index_64(target_square(possible_moves.get_move(i))) != target || pos.board[other] != piece) continue;
+            ambiguous = true;
+            if(other % 8 == source % 8) same_file = true;
+            if(other / 8 == source / 8) same_rank = true;
         }
+        if(ambiguous && (!same_file || same_rank)) san += 'a' + source % 8;
+        if(ambiguous && same_file) san += '8' - source / 8;
 
-        if(legal_moves == 0){
-            if(is_square_attacked(king_track[1]/16,king_track[1]%16,!side)){
-                return 100000 + depth;
-            }
-            else{
-                return 0;
+        if(capture_flag(move)) san += "x";
+        san += index_to_position[target/8][target%8];
+    }
+
+    // Check or mate
+    Undo undo;
+    make_move(pos, move, undo);
+    if(in_check(pos, pos.side_to_move)){
+        Moves replies;
+        generate_moves(pos, replies, false, true);
+        san += replies.get_count() ? "+" : "#";
+    }
+    unmake_move(pos, move, undo);
+    return san;
+}
+
+// Neither side can mate, only kings with at most one bishop or knight left
+bool insufficient_material(Position &pos){
+    if(pos.bitboards[P] | pos.bitboards[p] | pos.bitboards[R] | pos.bitboards[r] | pos.bitboards[Q] | pos.bitboards[q]) return false;
+    return count_bits(pos.bitboards[B] | pos.bitboards[b] | pos.bitboards[N] | pos.bitboards[n]) <= 1;
+}
+
+struct SelfPlayGame{
+    int round;
+    string fen;                 // Opening position
+    vector<string> moves;       // SAN
+    string result;              // 1-0, 0-1 or 1/2-1/2
+    string termination;         // PGN Termination tag, normal or time forfeit
+    string reason;              // Comment after the last move
+};
+
+// Play one game, base_time & increment in ms (0 -> no clock, every move is searched with limits)
+void play_selfplay_game(SelfPlayGame &game, SearchLimits limits, long long base_time, long long increment, TranspositionTable *tables[2]){
+    Position position;
+    parse_fen_string_to_board(position, game.fen);
+
+    SearchOptions options[2] = {engine_options, engine_options};
+    for(int side=white;side<=black;side++){
+        options[side].threads = 1;
+        options[side].table = tables[side];
+        tables[side]->clear();
+    }
+
+    long long clock[2] = {base_time, base_time};
+    game.termination = "normal";
+
+    while(true){
+        int side = position.side_to_move;
+        Moves possible_moves;
+        generate_moves(position, possible_moves, false, true);
+        if(!possible_moves.get_count()){
+            bool mated = in_check(position, side);
+            game.result = !mated ? "1/2-1/2" : side == white ? "0-1" : "1-0";
+            game.reason = !mated ? "Draw by stalemate" : side == white ? "Black mates" : "White mates";
+            return;
+        }
+        if(position.halfmove_clock >= 100){
+            game.result = "1/2-1/2";
+            game.reason = "Draw by fifty-move rule";
+            return;
+        }
+        if(is_repetition(position, 2)){
+            game.result = "1/2-1/2";
+            game.reason = "Draw by threefold repetition";
+            return;
+        }
+        if(insufficient_material(position)){
+            game.result = "1/2-1/2";
+            game.reason = "Draw by insufficient material";
+            return;
+        }
+
+        if(base_time > 0){
+            limits.wtime = clock[white];
+            limits.btime = clock[black];
+            limits.winc = limits.binc = increment;
+        }
+        SearchResult result;
+        atomic<bool> stop(false);
+        auto start_time = chrono::steady_clock::now();
+        search_position(position, limits, options[side], result, stop);
+
+        if(base_time > 0){
+            clock[side] -= elapsed_ms(start_time);
+            if(clock[side] < 0){
+                game.result = side == white ? "0-1" : "1-0";
+                game.termination = "time forfeit";
+                game.reason = side == white ? "White loses on time" : "Black loses on time";
+                return;
             }
+            clock[side] += increment;
         }
 
-        final_best_move = best_move;
-        return best_score;
+        int move = result.best_move;
+        game.moves.push_back(move_to_san(position, move));
+        Undo undo;
+        make_move(position, move, undo);
+        trim_key_history(position);
     }
 }
 
-// Performance Test by checking number of valid generated moves
-int nodes=0;
-// int captures=0;
-// int castles=0;
-// int promotions=0;
-void performance_test(int side, int depth){
-    if(depth == 0){
-        nodes++;
-        return;
+// PGN of a finished game, moves are wrapped at 80 characters
+string selfplay_pgn(SelfPlayGame &game, string &time_control, string &date){
+    string pgn = "[Event \"Self-play\"]\n[Site \"?\"]\n[Date \"" + date + "\"]\n[Round \"" + to_string(game.round) + "\"]\n";
+    pgn += "[White \"chess\"]\n[Black \"chess\"]\n[Result \"" + game.result + "\"]\n";
+    if(game.fen != starting_position) pgn += "[SetUp \"1\"]\n[FEN \"" + game.fen + "\"]\n";
+    pgn += "[TimeControl \"" + time_control + "\"]\n[Termination \"" + game.termination + "\"]\n\n";
+
+    Position position;
+    parse_fen_string_to_board(position, game.fen);
+    int move_number = position.fullmove_number, side = position.side_to_move;
+
+    vector<string> tokens;
+    for(int i=0;i<(int)game.moves.size();i++){
+        if(side == white) tokens.push_back(to_string(move_number) + ". " + game.moves[i]);
+        else if(i == 0) tokens.push_back(to_string(move_number) + "... " + game.moves[i]);
+        else tokens.push_back(game.moves[i]);
+        if(side == black) move_number++;
+        side = !side;
     }
+    tokens.push_back("{" + game.reason + "}");
+    tokens.push_back(game.result);
+
+    int line_length = 0;
+    for(int i=0;i<(int)tokens.size();i++){
+        if(line_length && line_length + 1 + (int)tokens[i].size() > 80){
+            pgn += "\n";
+            line_length = 0;
+        }
+        else if(line_length){
+            pgn += " ";
+            line_length++;
+        }
+        pgn += tokens[i];
+        line_length += tokens[i].size();
+    }
+    return pgn + "\n\n";
+}
 
-    Moves possible_moves;
-    generate_moves(side, possible_moves);
+// Openings of a FEN / EPD file, one position per line, invalid positions are skipped with a warning
+// Returned as full FENs, with the counters of the line if it has them
+vector<string> read_openings(istream &input){
+    vector<string> openings;
+    string line;
+    while(getline(input, line)){
+        if(line.find_first_not_of(" \t\r") == string::npos) continue;
+
+        Position position;
+        size_t fen_length;
+        fen_errors error = parse_fen_string_to_board(position, line, &fen_length);
+        if(error != fen_ok){
+            cerr << "Skipping invalid opening (" << fen_error_message[error] << "): " << line << endl;
+            continue;
+        }
+        openings.push_back(board_to_fen_string(position));
+    }
+    return openings;
+}
+
+// Play games on workers threads, openings are FENs (the starting position if empty)
+// base_time & increment in ms, 0 -> every move is searched with limits
+void selfplay(int games, vector<string> &openings, SearchLimits &limits, long long base_time, long long increment, int workers, int hash_mb, ostream &output){
+    if(openings.empty()) openings.push_back(starting_position);
+    workers = max(1, min(workers, games));
+
+    // Seconds, e.g. 60+0.5, - if untimed
+    ostringstream time_control_text;
+    if(base_time > 0){
+        time_control_text << base_time / 1000.0;
+        if(increment > 0) time_control_text << "+" << increment / 1000.0;
+    }
+    else time_control_text << "-";
+    string time_control = time_control_text.str();
+    time_t now = time(nullptr);
+    char date[16];
+    strftime(date, sizeof(date), "%Y.%m.%d", localtime(&now));
+    string date_tag = date;
+
+    atomic<int> next_game(0);
+    mutex output_lock;
+    int score[3] = {0, 0, 0};    // White wins, draws, black wins
+
+    auto run_worker = [&](){
+        TranspositionTable white_table(hash_mb), black_table(hash_mb);
+        TranspositionTable *tables[2] = {&white_table, &black_table};
+        int round;
+        while((round = next_game++) < games){
+            SelfPlayGame game;
+            game.round = round + 1;
+            game.fen = openings[round % openings.size()];
+            play_selfplay_game(game, limits, base_time, increment, tables);
+
+            lock_guard<mutex> guard(output_lock);
+            output << selfplay_pgn(game, time_control, date_tag) << flush;
+            score[game.result == "1-0" ? 0 : game.result == "0-1" ? 2 : 1]++;
+            cerr << "Game " << game.round << ": " << game.result << " (" << game.reason << "), +" << score[0] << " =" << score[1] << " -" << score[2] << endl;
+        }
+    };
 
-    // if(depth == 1) cout<<possible_moves.get_count()<<endl;
-    // if(depth == 1) possible_moves.print_all_moves();
+    vector<thread> threads;
+    for(int i=0;i<workers;i++) threads.emplace_back(run_worker);
+    for(int i=0;i<workers;i++) threads[i].join();
+}
 
-    int chess_board_copy[8][16];
-    copy(&chess_board[0][0], &chess_board[0][0] + 8*16, &chess_board_copy[0][0]);
-    int castle_copy = castle;
-    int enpassant_copy = enpassant;
-    side_to_move = side;
-    int king_track_copy[2];
-    copy(&king_track[0], &king_track[0] + 2, &king_track_copy[0]);
+// FEN Parsing Benchmark
+// Parses every line of a FEN / EPD file, or a million lines of benchmark, perft & broken FENs without one,
+// prints lines/sec & the lines per error, then checks that writing & parsing back each accepted FEN gives it again
+bool fen_benchmark(string file_name){
+    string text;
+    if(!file_name.empty()){
+        ifstream file(file_name, ios::binary);
+        if(!file){
+            cerr << "Can't open " << file_name << endl;
+            return false;
+        }
+        text.assign(istreambuf_iterator<char>(file), istreambuf_iterator<char>());
+    }
+    else{
+        vector<string> samples = benchmark_positions;
+        for(int i=0;i<(int)perft_suite.size();i++) samples.push_back(perft_suite[i].fen);
+        samples.push_back("8/8/8/8/8/8/8/8 w - - 0 1");
+        samples.push_back("rnbqkbnr/pppppppp/9/8/8/8/PPPPPPPP/RNBQKBNR w KQkq - 0 1");
+        samples.push_back("rnbqkbnr/pppppppp/8/8/8/8/PPPPPPPP/RNBQKBN1 w KQkq - 0 1");
+        samples.push_back("rnbqkbnr/pppppppp/8/8/4P3/8/PPPP1PPP/RNBQKBNR w KQkq e3 0 1");
+        for(int i=0;i<1000000;i++) text += samples[i % samples.size()] + "\n";
+    }
 
-    int count = possible_moves.get_count();
-    vector<int> moves = possible_moves.get_all_moves();
+    // Lines of the text without copying them
+    vector<string_view> lines;
+    string_view view = text;
+    for(size_t begin=0;begin<view.size();){
+        size_t end = min(view.find('\n', begin), view.size());
+        string_view line = view.substr(begin, end - begin);
+        if(line.find_first_not_of(" \t\r") != string_view::npos) lines.push_back(line);
+        begin = end + 1;
+    }
 
-    for(int i=0;i<count;i++){
-        if(!set_move(moves[i])){
-            copy(&chess_board_copy[0][0], &chess_board_copy[0][0] + 8*16, &chess_board[0][0]);
-            castle = castle_copy;
-            enpassant = enpassant_copy;
-            side_to_move = side;
-            copy(&king_track_copy[0], &king_track_copy[0] + 2, &king_track[0]);
-            continue;
+    long long errors[10] = {};
+    Position position;
+    auto start_time = chrono::steady_clock::now();
+    for(int i=0;i<(int)lines.size();i++){
+        size_t fen_length;
+        errors[parse_fen_string_to_board(position, lines[i], &fen_length)]++;
+    }
+    double seconds = max(elapsed_ms(start_time), 1LL) / 1000.0;
+
+    cout << lines.size() << " lines, " << text.size() / (1024.0 * 1024.0) << " MB in " << seconds << "s, " << (long long)(lines.size() / seconds) << " lines/sec" << endl;
+    for(int error=0;error<10;error++){
+        if(errors[error]) cout << "    " << fen_error_message[error] << ": " << errors[error] << endl;
+    }
+
+    // Round trip of the accepted FENs
+    long long mismatches = 0;
+    char written[MAX_FEN_LENGTH], rewritten[MAX_FEN_LENGTH];
+    for(int i=0;i<(int)lines.size();i++){
+        size_t fen_length;
+        if(parse_fen_string_to_board(position, lines[i], &fen_length) != fen_ok) continue;
+        int length = write_fen_string(position, written);
+        if(parse_fen_string_to_board(position, string_view(written, length)) != fen_ok || write_fen_string(position, rewritten) != length || memcmp(written, rewritten, length)) mismatches++;
+    }
+    cout << "Round trip mismatches: " << mismatches << endl;
+    return mismatches == 0;
+}
+
+// FEN Fuzzing
+// Properties every input has to keep, the parser never reads outside the input & an accepted FEN writes back to
+// a FEN parsing to the same position, whose legal moves all make & unmake back to the same hash key
+bool fen_fuzz_check(string_view input){
+    Position position, reparsed;
+    size_t fen_length;
+    if(parse_fen_string_to_board(position, input, &fen_length) != fen_ok) return true;
+    if(fen_length > input.size()) return false;
+
+    char written[MAX_FEN_LENGTH];
+    int length = write_fen_string(position, written);
+    if(parse_fen_string_to_board(reparsed, string_view(written, length)) != fen_ok || reparsed.hash_key != position.hash_key) return false;
+
+    Moves possible_moves;
+    generate_moves(position, possible_moves, false, true);
+    for(int i=0;i<possible_moves.get_count();i++){
+        Undo undo;
+        U64 hash_key = position.hash_key;
+        make_move(position, possible_moves.get_move(i), undo);
+        unmake_move(position, possible_moves.get_move(i), undo);
+        if(position.hash_key != hash_key) return false;
+    }
+    return true;
+}
+
+// Mutation fuzzer, iterations inputs made by overwriting, inserting, erasing & cutting characters of valid FENs
+// (every 50th input is random bytes), reproducible from the seed
+// Prints the first failing inputs & returns false if any input breaks fen_fuzz_check
+bool fen_fuzz(long long iterations, U64 seed){
+    vector<string> seeds = benchmark_positions;
+    for(int i=0;i<(int)perft_suite.size();i++) seeds.push_back(perft_suite[i].fen);
+    seeds.push_back("rnbqkbnr/pppp1ppp/8/4p3/4P3/8/PPPP1PPP/RNBQKBNR w KQkq e6 0 2");
+    string alphabet = "pnbrqkPNBRQK12345678/-wabcdefgh0369 \t\r\n.o\x01\xff";
+
+    mt19937_64 generator(seed);
+    long long accepted = 0, failures = 0;
+    for(long long i=0;i<iterations;i++){
+        string input;
+        if(i % 50 == 0){
+            for(int j=generator()%90;j>0;j--) input += (char)(generator() & 0xFF);
         }
-        // if(depth == 2){
-        //     cout<<"\n\n";
-        //     print_decoded_move(moves[i]);
-        //     cout<<endl;
-        // }
-        // if(depth == 1){
-        //     print_decoded_move(moves[i]);
-        //     cout<<endl;
-        // }
-        // if(capture_flag(moves[i])) captures++;
-        // if(castling_flag(moves[i])) castles++;
-        // if(promoted_piece(moves[i]) > 0) promotions++;
-
-        // getchar();
-        // print_chess_board();
-        
-        performance_test(!side, depth-1);
-        copy(&chess_board_copy[0][0], &chess_board_copy[0][0] + 8*16, &chess_board[0][0]);
-        castle = castle_copy;
-        enpassant = enpassant_copy;
-        side_to_move = side;
-        copy(&king_track_copy[0], &king_track_copy[0] + 2, &king_track[0]);
-    }
-}
-
-// TODO: Encoding & Decoding chess moves as integers
+        else{
+            input = seeds[generator() % seeds.size()];
+            for(int mutations=1+generator()%4;mutations>0;mutations--){
+                size_t at = generator() % (input.size() + 1);
+                char c = alphabet[generator() % alphabet.size()];
+                switch(generator() % 4){
+                    case 0: if(at < input.size()) input[at] = c; break;
+                    case 1: input.insert(input.begin() + at, c); break;
+                    case 2: if(at < input.size()) input.erase(at, 1); break;
+                    case 3: input.resize(at); break;
+                }
+            }
+        }
+
+        Position position;
+        size_t fen_length;
+        if(parse_fen_string_to_board(position, input, &fen_length) == fen_ok) accepted++;
+        if(!fen_fuzz_check(input) && ++failures <= 5) cout << "Failed: \"" << input << "\"" << endl;
+    }
+    cout << iterations << " inputs, " << accepted << " accepted, " << failures << " failures (seed " << seed << ")" << endl;
+    return failures == 0;
+}
+
+#ifdef FEN_FUZZ
+// libFuzzer entry point, build the library with it, e.g.
+//     clang++ -g -O1 -std=c++17 -fsanitize=fuzzer,address,undefined -DCHESS_LIBRARY -DFEN_FUZZ chess.cpp -o fen_fuzz
+extern "C" int LLVMFuzzerTestOneInput(const uint8_t *data, size_t size){
+    init_library();
+    if(!fen_fuzz_check(string_view((const char *)data, size))) abort();
+    return 0;
+}
+#endif
 
 string test_position = "r3k2r/p1ppqpb1/bn2pnp1/3PN3/1p2P3/2N2Q1p/PPPBBPPP/R3K2R w KQkq - ";
 // string mate_position = "3k4/5Q2/8/4Q3/2K5/8/8/8 w - - ";
 
-int main() {
-    // Your code here
-    cout << "Initializing Chess Board..... \n\n";
-    // chess_board[e2/16][e2%16] = e;
-    // chess_board[e4/16][e4%16] = P;
-    
-    clear_board();
-    // parse_fen_string_to_board(random_position);
-    // parse_fen_string_to_board(starting_position);
-    parse_fen_string_to_board(test_position);
-    // parse_fen_string_to_board(mate_position);
-    print_chess_board();
-    // print_attacked_squares(side_to_move);
-    // Moves possible_moves;
-    // generate_moves(side_to_move, possible_moves);
-    // possible_moves.print_all_moves();
-
-    // cout << "\nScore: " << evaluate_position() << endl;
-
-    int final_best_score = find_best_move(side_to_move, 5, INT_MIN, INT_MAX);
-    cout << "\n\nBest Move: ";
-    print_decoded_move(final_best_move);
-    cout << "\n\nBest Score: " << final_best_score <<endl;
-
-    // performance_test(0,5);
-    // cout << "\n\nTotal Nodes: " << nodes << endl;
-    // cout << "Total Captures: " << captures << endl;
-    // cout << "Total Castles: " << castles << endl;
-    // cout << "Total Promotions: " << promotions << endl;
-
-
-    // moves_history.add_move(encode_move_to_integer(a2,a4,0,0,0,0,1));
-    // moves_history.print_all_moves();
-
-    // TODO: Remove this later
-    // for(int i=0;i<8;i++){
-    //     for(int j=0;j<8;j++){
-    //         cout<<char('a'+j)<<8-i<<", ";
-    //     }
-    //     cout<<endl;
-    // }
+#ifndef CHESS_LIBRARY
+// Allocation Counting
+// The global operator new counts heap allocations while allocation_counting is set, for the allocation test
+// Left out of library builds, a library must not replace the allocator of the program using it
+atomic<bool> allocation_counting(false);
+atomic<long long> allocation_count(0);
+
+void *operator new(size_t size){
+    if(allocation_counting.load(memory_order_relaxed)) allocation_count++;
+    void *memory = malloc(size ? size : 1);
+    if(!memory) throw bad_alloc();
+    return memory;
+}
+// Not inlined, else GCC sees free called on memory from operator new & warns (-Wmismatched-new-delete)
+__attribute__((noinline)) void operator delete(void *memory) noexcept{
+    free(memory);
+}
+__attribute__((noinline)) void operator delete(void *memory, size_t) noexcept{
+    free(memory);
+}
+
+// Search nodes & perft must not touch the heap, counts the allocations of an iterative deepening search to depth 6
+// and a perft 4 on test_position, returns false unless there are none
+bool allocation_test(){
+    Position position;
+    parse_fen_string_to_board(position, test_position);
+
+    // Everything the search needs is set up before counting, as search_position does
+    TranspositionTable table(16);
+    atomic<bool> stop(false);
+    SearchContext *search = new SearchContext();
+    search->pos = position;
+    search->options = engine_options;
+    search->options.threads = 1;
+    search->options.table = &table;
+    search->nodes = 0;
+    search->stop = &stop;
+    search->time_limit = -1;
+    search->node_limit = -1;
+    search->start_time = chrono::steady_clock::now();
+    search->next_check = 0;
+    search->threads = search;
+    search->thread_count = 1;
+
+    allocation_count = 0;
+    allocation_counting = true;
+    int score = 0;
+    for(int depth=1;depth<=6;depth++) score = aspiration_search(*search, depth, score);
+    long long perft_nodes = performance_test(position, 4);
+    allocation_counting = false;
+
+    cout << "Search: " << search->nodes << " nodes, perft: " << perft_nodes << " nodes, heap allocations: " << allocation_count << endl;
+    delete search;
+    return allocation_count == 0;
+}
+
+int main(int argc, char *argv[]) {
+    init_attack_tables();
+    init_hash_keys();
+    init_evaluation_tables();
+    init_search_tables();
+
+    // Startup options
+    // chess [-hash MB] [-perfthash MB] [-threads N] [-nullmove R] [-lmr N] [-depth N] [-movetime MS] [-nodes N] [-tc BASE+INC] ...
+    // Transposition table & perft hash table sizes in MB (default 16 & 0), search & perft threads (default 1),
+    // pruning options (see find_best_move), limits of the search (default depth 5) & self-play time control
+    SearchLimits limits = {};
+    long long base_time = 0, increment = 0;
+    int hash_mb = 16, arg = 1;
+    while(arg + 1 < argc && argv[arg][0] == '-'){
+        string option = argv[arg];
+        if(option == "-hash") hash_mb = max(1, atoi(argv[arg+1]));
+        else if(option == "-perfthash") perft_table.resize(atoi(argv[arg+1]));
+        else if(option == "-threads") engine_options.threads = max(1, atoi(argv[arg+1]));
+        else if(option == "-nullmove") engine_options.null_move_reduction = max(0, atoi(argv[arg+1]));
+        else if(option == "-lmr") engine_options.lmr_full_depth_moves = max(0, atoi(argv[arg+1]));
+        else if(option == "-depth") limits.depth = atoi(argv[arg+1]);
+        else if(option == "-movetime") limits.movetime = atoll(argv[arg+1]);
+        else if(option == "-nodes") limits.nodes = atoll(argv[arg+1]);
+        else if(option == "-tc"){
+            string time_control = argv[arg+1];
+            base_time = (long long)(atof(time_control.c_str()) * 1000);
+            if(time_control.find('+') != string::npos) increment = (long long)(atof(time_control.c_str() + time_control.find('+') + 1) * 1000);
+        }
+        arg += 2;
+    }
+    if(!limits.depth && !limits.movetime && !limits.nodes && !base_time) limits.depth = 5;
+    transposition_table.resize(hash_mb);
+
+    // FEN of the command line, false with a message if it is rejected
+    auto fen_valid = [](string &fen){
+        Position position;
+        fen_errors error = parse_fen_string_to_board(position, fen);
+        if(error != fen_ok) cerr << "Invalid FEN: " << fen_error_message[error] << endl;
+        return error == fen_ok;
+    };
+
+    // Perft benchmark mode
+    // chess perft [depth] [fen], defaults to depth 4 on test_position
+    if(arg < argc && string(argv[arg]) == "perft"){
+        int depth = arg + 1 < argc ? atoi(argv[arg+1]) : 4;
+        string fen = arg + 2 < argc ? argv[arg+2] : test_position;
+        if(!fen_valid(fen)) return 1;
+        perft_benchmark(fen, depth);
+        return 0;
+    }
+
+    // Divide perft mode
+    // chess divide [depth] [fen], defaults to depth 4 on test_position, root moves are split over -threads threads
+    if(arg < argc && string(argv[arg]) == "divide"){
+        int depth = arg + 1 < argc ? atoi(argv[arg+1]) : 4;
+        string fen = arg + 2 < argc ? argv[arg+2] : test_position;
+        if(!fen_valid(fen)) return 1;
+        perft_divide(fen, depth);
+        return 0;
+    }
+
+    // Perft suite mode
+    // chess perftsuite, exits with 1 if any node count is wrong
+    if(arg < argc && string(argv[arg]) == "perftsuite"){
+        return perft_suite_test() ? 0 : 1;
+    }
+
+    // SEE suite mode
+    // chess seesuite, exits with 1 if any exchange value is wrong
+    if(arg < argc && string(argv[arg]) == "seesuite"){
+        return see_suite_test() ? 0 : 1;
+    }
+
+    // Allocation test mode
+    // chess alloctest, exits with 1 if searching or perft allocate on the heap
+    if(arg < argc && string(argv[arg]) == "alloctest"){
+        return allocation_test() ? 0 : 1;
+    }
+
+    // SMP benchmark mode
+    // chess smp [depth] [max threads], defaults to depth 6 with 1 to -threads (or hardware) threads on test_position
+    if(arg < argc && string(argv[arg]) == "smp"){
+        int depth = arg + 1 < argc ? atoi(argv[arg+1]) : 6;
+        int max_threads = arg + 2 < argc ? atoi(argv[arg+2]) : max(engine_options.threads, (int)thread::hardware_concurrency());
+        smp_benchmark(test_position, depth, max_threads);
+        return 0;
+    }
+
+    // Search benchmark mode
+    // chess bench [depth], defaults to depth 7 over benchmark_positions
+    if(arg < argc && string(argv[arg]) == "bench"){
+        search_benchmark(arg + 1 < argc ? atoi(argv[arg+1]) : 7);
+        return 0;
+    }
+
+    // FEN parsing benchmark mode
+    // chess fenbench [file], exits with 1 if a FEN doesn't survive writing & parsing back
+    if(arg < argc && string(argv[arg]) == "fenbench"){
+        return fen_benchmark(arg + 1 < argc ? argv[arg+1] : "") ? 0 : 1;
+    }
+
+    // FEN fuzzing mode
+    // chess fenfuzz [inputs] [seed], defaults to a million inputs with seed 1, exits with 1 if any input fails
+    // Build with -fsanitize=address,undefined to catch reads outside the input as well
+    if(arg < argc && string(argv[arg]) == "fenfuzz"){
+        long long iterations = arg + 1 < argc ? atoll(argv[arg+1]) : 1000000;
+        U64 seed = arg + 2 < argc ? strtoull(argv[arg+2], nullptr, 10) : 1;
+        return fen_fuzz(iterations, seed) ? 0 : 1;
+    }
+
+    // Batch analysis mode
+    // chess batch [file], reads stdin without a file, one worker per -threads thread with a -hash MB table each
+    if(arg < argc && string(argv[arg]) == "batch"){
+        if(arg + 1 < argc){
+            ifstream file(argv[arg+1]);
+            if(!file){
+                cerr << "Can't open " << argv[arg+1] << endl;
+                return 1;
+            }
+            batch_analysis(file, cout, limits, engine_options.threads, hash_mb);
+        }
+        else batch_analysis(cin, cout, limits, engine_options.threads, hash_mb);
+        return 0;
+    }
+
+    // Self-play mode
+    // chess [-tc BASE+INC] selfplay [games] [openings file], defaults to 10 games from the starting position
+    // Writes PGN to stdout & the running score to stderr, one game per -threads thread
+    // Moves are searched with the startup limits, or with the clock if a time control is given (seconds, e.g. 10+0.1)
+    if(arg < argc && string(argv[arg]) == "selfplay"){
+        int games = arg + 1 < argc ? atoi(argv[arg+1]) : 10;
+        vector<string> openings;
+        if(arg + 2 < argc){
+            ifstream file(argv[arg+2]);
+            if(!file){
+                cerr << "Can't open " << argv[arg+2] << endl;
+                return 1;
+            }
+            openings = read_openings(file);
+            if(openings.empty()){
+                cerr << "No valid opening in " << argv[arg+2] << endl;
+                return 1;
+            }
+        }
+        selfplay(games, openings, limits, base_time, increment, engine_options.threads, hash_mb, cout);
+        return 0;
+    }
+
+    // Search mode
+    // chess search, prints the search of test_position with the startup limits
+    if(arg < argc && string(argv[arg]) == "search"){
+        Position position;
+        // parse_fen_string_to_board(position, random_position);
+        // parse_fen_string_to_board(position, starting_position);
+        parse_fen_string_to_board(position, test_position);
+        // parse_fen_string_to_board(position, mate_position);
+        print_chess_board(position);
+        // print_attacked_squares(position, position.side_to_move);
+        // Moves possible_moves;
+        // generate_moves(position, possible_moves);
+        // possible_moves.print_all_moves();
+
+        // cout << "\nScore: " << evaluate_position(position) << endl;
+
+        SearchResult result;
+        atomic<bool> stop(false);
+        int final_best_score = search_position(position, limits, engine_options, result, stop, [](SearchResult &iteration){
+            cout << "Depth " << iteration.depth << ": score " << iteration.score << ", " << iteration.nodes << " nodes, " << iteration.time << " ms, pv";
+            for(int move : iteration.pv) cout << " " << move_to_uci(move);
+            cout << endl;
+        });
+        cout << "\n\nBest Move: ";
+        print_decoded_move(result.best_move);
+        cout << "\n\nBest Score: " << final_best_score <<endl;
+        cout << "\nNodes: " << result.nodes << " (" << engine_options.threads << " threads)" << endl;
+        cout << "\nQuiescence nodes: " << result.quiescence_nodes << " (" << (result.nodes ? 100.0 * result.quiescence_nodes / result.nodes : 0) << "%)" << endl;
+        cout << "\nFirst move cutoffs: " << result.first_move_cutoffs << " / " << result.cutoffs << " (" << (result.cutoffs ? 100.0 * result.first_move_cutoffs / result.cutoffs : 0) << "%)" << endl;
+        cout << "\nHash table (" << transposition_table.size_mb() << " MB): " << transposition_table.hits << " hits, " << transposition_table.misses << " misses, " << transposition_table.overwrites << " overwrites" << endl;
+
+        // performance_test(position, 5);
+        // cout << "\n\nTotal Nodes: " << nodes << endl;
+        // cout << "Total Captures: " << captures << endl;
+        // cout << "Total Castles: " << castles << endl;
+        // cout << "Total Promotions: " << promotions << endl;
+
+
+        return 0;
+    }
+
+    // UCI mode (default)
+    uci_loop();
 
     return 0;
 }
+#endif
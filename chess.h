@@ -0,0 +1,66 @@
+// Chess Engine Library API
+// Build chess.cpp with -DCHESS_LIBRARY to leave out main(), e.g.
+//     g++ -O2 -std=c++17 -pthread -fPIC -shared -DCHESS_LIBRARY chess.cpp -o libchess.so
+//     g++ -O2 -std=c++17 -pthread -c -DCHESS_LIBRARY chess.cpp && ar rcs libchess.a chess.o
+//
+// Each engine owns its position, transposition table & search threads, engines share nothing
+// All functions may be called from any thread, calls on one engine are serialized except chess_engine_cancel,
+// which stops a running search so that the blocked calls can go ahead
+#ifndef CHESS_H
+#define CHESS_H
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+typedef struct chess_engine chess_engine;
+
+// Search limits, 0 -> not set, no limit at all searches until cancelled
+typedef struct{
+    int depth;
+    long long movetime;         // ms for this move
+    long long wtime, btime;     // ms left on the clocks
+    long long winc, binc;       // ms increment per move
+    int movestogo;
+    long long nodes;
+} chess_limits;
+
+// Result of a completed search iteration
+// Moves are in coordinate notation (e2e4, e7e8q), scores are for the side to move
+typedef struct{
+    int depth;
+    int score;                  // centipawns, if mate is 0
+    int mate;                   // moves to mate, negative if the side to move gets mated, 0 if no mate found
+    long long nodes;
+    long long time;             // ms
+    char best_move[6];
+    char pv[1024];              // space separated
+} chess_info;
+
+// Called by the searching thread after each completed iteration
+typedef void (*chess_callback)(const chess_info *info, void *user_data);
+
+// New engine on the starting position, NULL if out of memory
+// hash_mb is the transposition table size, at least 1 (smaller values give 1 MB)
+chess_engine *chess_engine_create(int hash_mb, int threads);
+
+// Set the position, returns 0 or -1 if the FEN is rejected (the position is unchanged then)
+int chess_engine_set_fen(chess_engine *engine, const char *fen);
+
+// Search the position, blocking until a limit is hit or chess_engine_cancel is called
+// on_iteration may be NULL, result (may be NULL) receives the last completed iteration
+// Returns 0 or -1 if the side to move has no legal move
+int chess_engine_search(chess_engine *engine, const chess_limits *limits, chess_callback on_iteration, void *user_data, chess_info *result);
+
+// Stop the running search of the engine & the search calls waiting for it
+// Without a running search the next search call returns right away, the cancel is used up when a search returns
+void chess_engine_cancel(chess_engine *engine);
+
+// Stop any search & free the engine
+void chess_engine_destroy(chess_engine *engine);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif